@@ -0,0 +1,46 @@
+#ifndef SIMPLEVOXELTRACER_CHUNK_CACHE_H
+#define SIMPLEVOXELTRACER_CHUNK_CACHE_H
+
+#include "terrain.h"
+#include "gllib.h"
+
+// GPU side cache for the chunk pools, used when the pools don't fit into GPU memory
+// a fixed number of brick slots (512 bytes of blocks, 64 bytes of bitmask and the chunk mips each) is filled with the chunks closest to the camera,
+// an indirection table maps every pool index to its slot, chunks that aren't resident are traced as uniformly filled with an LOD block
+
+void chunkCache_init(StagingRing* uploadRing);
+
+void chunkCache_destroy(void);
+
+// GPU memory used for the brick slots, the cache is rebuilt with the new size on the next update
+void chunkCache_setBudget(u64 bytes);
+
+u64 chunkCache_getBudget(void);
+
+void chunkCache_setEnabled(bool enabled);
+
+bool chunkCache_isEnabled(void);
+
+// drops all resident chunks and rebuilds the indirection table (the terrain changed)
+// releases all GPU memory of the cache while it's disabled
+void chunkCache_reset(const Terrain* terrain);
+
+// updates the pool indices begin..end after the terrain changed, without dropping the resident chunks
+// data, bitmasks and mips hold the chunks of that range (e.g. a copy taken earlier), NULL reads them from the terrain
+void chunkCache_refresh(const Terrain* terrain, u32 begin, u32 end, const u8* data, const u8* bitmasks, const u32* mips);
+
+// streams in the chunks closest to the camera, evicting the least recently used ones
+void chunkCache_update(const Terrain* terrain, vec3 camPos);
+
+u32 chunkCache_getDataBuffer(void);
+
+u32 chunkCache_getBitmaskBuffer(void);
+
+u32 chunkCache_getIndirectionBuffer(void);
+
+// CHUNK_MIP_WORDS per brick slot
+u32 chunkCache_getMipBuffer(void);
+
+u32 chunkCache_getResidentCount(void);
+
+#endif //SIMPLEVOXELTRACER_CHUNK_CACHE_H
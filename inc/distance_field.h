@@ -0,0 +1,74 @@
+#ifndef SIMPLEVOXELTRACER_DISTANCE_FIELD_H
+#define SIMPLEVOXELTRACER_DISTANCE_FIELD_H
+
+#include "terrain.h"
+#include "gllib.h"
+
+// metric used for the distance field of empty chunks
+typedef enum DistanceFieldMode {
+    DF_MODE_MANHATTAN,
+    DF_MODE_EUCLIDEAN,
+    DF_MODE_COUNT
+} DistanceFieldMode;
+
+// the top level array is uploaded through the given ring
+void distanceField_init(StagingRing* uploadRing);
+
+void distanceField_destroy(void);
+
+void distanceField_loadShaders(void);
+
+// compiles the shaders in the background, distanceField_update swaps them in once all of them are done
+// the current shaders stay in use if compiling fails
+void distanceField_reloadShaders(void);
+
+void distanceField_freeShaders(void);
+
+// uploads the top level array and builds the DF on top of it
+// in sliced mode the build runs into a second buffer over the next frames, while the current DF stays in use
+// allowSliced = false builds right away, e.g. if the chunk buffers the current DF points into were replaced
+void distanceField_rebuild(Terrain* terrain, bool allowSliced);
+
+// continues a sliced build within the time budget and swaps the buffers once it is done
+// returns true if it swapped them, the chunks the new top level array references have to be uploaded before the next trace
+bool distanceField_update(void);
+
+bool distanceField_isRebuilding(void);
+
+// true if a setting changed that requires a rebuild
+bool distanceField_isOutdated(void);
+
+// top level array (with the DF in all empty chunks) that is currently valid for tracing
+u32 distanceField_getChunkArrayBuffer(void);
+
+// 8 bytes per chunk, one manhattan distance per ray octant
+u32 distanceField_getOctantBuffer(void);
+
+// settings the buffers in use were built with (these lag behind the requested settings while rebuilding)
+DistanceFieldMode distanceField_getActiveMode(void);
+
+bool distanceField_getActiveOctant(void);
+
+void distanceField_setMode(DistanceFieldMode mode);
+
+DistanceFieldMode distanceField_getMode(void);
+
+// the octant DF holds a separate distance for each ray direction octant (8 bytes per chunk)
+void distanceField_setOctant(bool enabled);
+
+bool distanceField_getOctant(void);
+
+// builds the manhattan DF with one workgroup per line (shared memory scan) instead of one invocation per line
+void distanceField_setParallelBuild(bool enabled);
+
+bool distanceField_getParallelBuild(void);
+
+// spreads rebuilds over multiple frames, only spending the given GPU time per frame
+void distanceField_setSliced(bool enabled, float budgetMs);
+
+bool distanceField_getSliced(void);
+
+// times both manhattan DF builders on the given terrain and checks that their results are identical
+void distanceField_benchmark(Terrain* terrain, u32 runs);
+
+#endif //SIMPLEVOXELTRACER_DISTANCE_FIELD_H
@@ -0,0 +1,23 @@
+#ifndef SIMPLEVOXELTRACER_FRAME_RECORDER_H
+#define SIMPLEVOXELTRACER_FRAME_RECORDER_H
+
+#include "cpmath.h"
+
+// records the frames shown in the window as raw RGBA8 frames (top row first, no header) without stalling the renderer:
+// every frame is read into a ring of pixel buffers, and a writer thread writes it out once its fence signals
+// a path starting with | is run as a command that reads the frames from its stdin, e.g.
+//   --record "|ffmpeg -f rawvideo -pixel_format rgba -video_size 1024x768 -framerate 60 -i - video.mp4"
+
+// returns false if the file or command couldn't be opened
+bool frameRecorder_start(const char* path, uvec2 size);
+
+// reads the back buffer of the window, call after a frame was drawn and before it is swapped
+// stops the recording if the size of the window changed, since raw frames can't change their size
+void frameRecorder_captureFrame(uvec2 size);
+
+// waits until all captured frames are written
+void frameRecorder_stop(void);
+
+bool frameRecorder_isRecording(void);
+
+#endif //SIMPLEVOXELTRACER_FRAME_RECORDER_H
@@ -9,11 +9,56 @@ typedef struct Texture
     u32 internalFormat;
 } Texture;
 
+#define STAGING_RING_SEGMENTS 4
+
+// persistently mapped upload buffer, data is copied into it on the CPU and from there into the destination on the GPU
+// the ring is split into segments, a segment is only written again once the GPU has finished all copies out of it
+typedef struct StagingRing
+{
+    u32 buffer;
+    u8* memory;
+    u32 size;
+    u32 segmentSize;
+    u32 head;
+    void* fences[STAGING_RING_SEGMENTS]; // GLsync
+} StagingRing;
+
+typedef void* (*GllibLoadProc)(const char* name);
+
+// loads the optional extensions glad doesn't know about, call once after the context was created
+void gllib_init(GllibLoadProc loadProc);
+
+// how many workgroups of the given size the GPU can run at once by its thread limits (NV_shader_thread_group), 0 if the driver doesn't tell
+// registers and shared memory can lower the real number, so it's an upper bound
+u32 gllib_getResidentWorkGroups(u32 groupInvocations);
+
 u32 gllib_makePipeline(const char* vertPath, const char* fragPath);
 u32 gllib_makeCompute(const char* shaderPath);
 
+// compute programs are loaded from the program binary cache if the preprocessed source and driver didn't change,
+// otherwise compiling is only started here (in parallel with KHR_parallel_shader_compile) and has to be finished later
+u32 gllib_startCompute(const char* shaderPath);
+
+// variants are compiled with the given #define lines (e.g. "#define FOO 1\n") inserted right after the #version directive
+u32 gllib_makeComputeVariant(const char* shaderPath, const char* defines);
+u32 gllib_startComputeVariant(const char* shaderPath, const char* defines);
+
+// true once finishing the program won't block
+bool gllib_isProgramReady(u32 program);
+
+// checks the compile status and stores newly compiled programs in the cache
+// returns false (the error is logged and the program deleted) if compiling failed
+bool gllib_finishProgram(u32 program);
+
 Texture gllib_makeDefaultTexture(u32 width, u32 height, u32 glInternalFormat, u32 glFilter);
 void gllib_destroyTexture(Texture* texture);
 void gllib_bindTexture(const Texture* texture, u32 idx, u32 glUsage);
 
+// replaces the buffer with a larger one, the old contents are copied on the GPU
+void gllib_growBuffer(u32* buffer, u64 oldSize, u64 newSize, u32 glUsage);
+
+StagingRing gllib_makeStagingRing(u32 size);
+void gllib_destroyStagingRing(StagingRing* ring);
+void gllib_stagingUpload(StagingRing* ring, u32 dstBuffer, u64 dstOffset, const void* data, u64 size);
+
 #endif //FASTDRAW_GLLIB_H
@@ -2,13 +2,91 @@
 #define SIMPLEVOXELTRACER_GRAPHICS_H
 
 #include "terrain.h"
+#include "distance_field.h"
+
+// everything that trades image quality / memory for performance, can be changed every frame
 typedef struct RenderSettings {
+    // fraction of the window resolution that is traced, the image is scaled to the window afterwards
+    float resolutionScale;
+    // reduced resolution traces are upsampled along the depth and normals of the traced pixels instead of plain scaling
+    bool upsample;
+
+    // metric and layout of the distance field used to skip empty chunks
+    DistanceFieldMode dfMode;
+    bool octantDF;
+    bool parallelDFBuild;
+    // spreads DF rebuilds over multiple frames, spending at most slicedDFBudgetMs of GPU time per frame
+    bool slicedDFBuild;
+    float slicedDFBudgetMs;
+
+    // only keeps the chunks around the camera on the GPU (forced on if the pools exceed the cache budget)
+    bool chunkCache;
+
+    // far away chunks are traced at 2x2x2 or 4x4x4 block resolution once a cell covers less than this many pixels (0 = off)
+    float lodBias;
+
+    // workgroup size of the tracing shader (x * y <= 1024), 0x0 uses the size tuned for this device (see workgroup_tuner.h)
+    uvec2 workGroupSize;
+
+    // logs the GPU time of the tracing pass once per second
+    bool stats;
+    // starts every ray just short of the reprojected hit of the previous frame, where that part of the ray was seen to be empty
+    bool reprojection;
+    // starts the rays of every 8x8 pixel tile at the distance a cone around the tile could prove to be empty
+    bool conePrepass;
+    // starts every ray at the closest bounds of the non empty chunks, rasterized before tracing (pixels without any are sky)
+    bool rasterPrepass;
+
+    // only traces every other pixel per frame (alternating like a checkerboard), the others are filled from the previous frame or their neighbours
+    bool checkerboard;
+    // with the checkerboard, pixels further than this from the center (in half screen heights) are only traced every 4th frame (0 = off)
+    float peripheryRadius;
+
+    // the tracing pass only stores its hits (see initial.glsl GBUFFER), colors are computed by a separate shading pass
+    bool deferredShading;
+    // distance at which the fog covers 1 - 1/e of a surface, only with deferred shading (0 = off)
+    float fogDistance;
+
+    // the rays of a workgroup march together in rounds, the chunks around them are staged in shared memory before every round
+    bool cooperativeTraversal;
+    // only starts as many workgroups as fit on the GPU, they take screen tiles from a global queue until all are traced
+    bool persistentThreads;
+    // workgroups started with persistent threads, 0 = as many as the GPU reports it can run at once (1024 if it doesn't tell)
+    // too many only find the queue empty, too few leave parts of the GPU idle
+    u32 persistentGroupCount;
 
+    // colors every pixel by the number of traversal steps instead of the hit block
+    bool heatmap;
 } RenderSettings;
 
+// camera of one view of graphics_drawViews
+typedef struct RenderView
+{
+    vec3 camPos;
+    vec3 forward;
+    // vertical field of view in degrees, 0 uses the one of the window
+    float fieldOfView;
+    uvec2 size;
+    // only traces the part of a larger image of fullSize pixels starting at cropOffset (from the bottom left),
+    // so an image can be traced in tiles, 0x0 traces the whole view
+    uvec2 fullSize;
+    uvec2 cropOffset;
+} RenderView;
+
+// where a view was placed in the atlas
+typedef struct ViewRegion
+{
+    uvec2 offset;
+    uvec2 size;
+} ViewRegion;
+
+RenderSettings graphics_defaultRenderSettings(void);
+
+void graphics_logRenderSettings(const RenderSettings* settings);
+
 void graphics_init(void);
 
-void graphics_drawFrame(Terrain* terrain, vec3 camPos, vec3 forward);
+void graphics_drawFrame(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings);
 
 void graphics_destroy(void);
 
@@ -16,4 +94,19 @@ void graphics_reloadShaders(void);
 
 uvec2 graphics_getRes(void);
 
+// traces all views into one atlas texture with a single dispatch, regions receives the placement of every view
+// only the settings that apply to single pixels are used (no upsampling, reprojection, prepasses or checkerboard)
+// returns false if the atlas would exceed the maximum texture size
+bool graphics_drawViews(Terrain* terrain, const RenderView* views, u32 viewCount, const RenderSettings* settings, ViewRegion* regions);
+
+// copies a region of the last graphics_drawViews call into rgba (RGBA8, bottom row first)
+void graphics_readView(const ViewRegion* region, u8* rgba);
+
+// draws frames until the terrain is completely on the GPU (including its distance field)
+void graphics_finishTerrainUpload(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings);
+
+// times the tracing pass with the traversal variants (persistent threads, cooperative) against the plain one from the given camera,
+// after the terrain was uploaded
+void graphics_benchmarkTraversal(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings, u32 runs);
+
 #endif //SIMPLEVOXELTRACER_GRAPHICS_H
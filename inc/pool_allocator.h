@@ -39,7 +39,7 @@ static void* poolAllocatorAllocPtr(PoolAllocator* poolAllocator)
             poolAllocator->nextFree = (void*) *((uintptr_t*) poolAllocator->nextFree);
         } else if (poolAllocator->unused > 0)
         {
-            ptr = (void*) (((uintptr_t) poolAllocator->memory) + (poolAllocator->maxSize - poolAllocator->unused) * poolAllocator->unitSize);
+            ptr = (void*) (((uintptr_t) poolAllocator->memory) + (uintptr_t) (poolAllocator->maxSize - poolAllocator->unused) * poolAllocator->unitSize);
             poolAllocator->unused--;
         } else // allocator is full
         {
@@ -49,11 +49,11 @@ static void* poolAllocatorAllocPtr(PoolAllocator* poolAllocator)
                 poolAllocator->unused += poolAllocator->maxSize;
                 poolAllocator->maxSize *= 2;
                 void* oldMemory = poolAllocator->memory;
-                poolAllocator->memory = _mm_malloc(poolAllocator->maxSize * poolAllocator->unitSize, 64);
-                memcpy(poolAllocator->memory, oldMemory, poolAllocator->maxSize / 2 * poolAllocator->unitSize);
+                poolAllocator->memory = _mm_malloc((size_t) poolAllocator->maxSize * poolAllocator->unitSize, 64);
+                memcpy(poolAllocator->memory, oldMemory, (size_t) poolAllocator->maxSize / 2 * poolAllocator->unitSize);
                 _mm_free(oldMemory);
 
-                ptr = (void*) (((uintptr_t) poolAllocator->memory) + (poolAllocator->maxSize - poolAllocator->unused) * poolAllocator->unitSize);
+                ptr = (void*) (((uintptr_t) poolAllocator->memory) + (uintptr_t) (poolAllocator->maxSize - poolAllocator->unused) * poolAllocator->unitSize);
                 poolAllocator->unused--;
             }
             else
@@ -83,12 +83,12 @@ static INLINE void poolAllocatorDeallocPtr(PoolAllocator* poolAllocator, void* p
 
 static INLINE void poolAllocatorDealloc(PoolAllocator* poolAllocator, u32 idx)
 {
-    poolAllocatorDeallocPtr(poolAllocator, (void*) (((uintptr_t) poolAllocator->memory) + idx * poolAllocator->unitSize));
+    poolAllocatorDeallocPtr(poolAllocator, (void*) (((uintptr_t) poolAllocator->memory) + (uintptr_t) idx * poolAllocator->unitSize));
 }
 
 static INLINE void* poolAllocatorGet(const PoolAllocator* poolAllocator, u32 idx)
 {
-    return (void*) (((uintptr_t) poolAllocator->memory) + idx * poolAllocator->unitSize);
+    return (void*) (((uintptr_t) poolAllocator->memory) + (uintptr_t) idx * poolAllocator->unitSize);
 }
 
 // creates memory internally if memory = NULL
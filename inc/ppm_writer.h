@@ -0,0 +1,29 @@
+#ifndef SIMPLEVOXELTRACER_PPM_WRITER_H
+#define SIMPLEVOXELTRACER_PPM_WRITER_H
+
+#include <stdio.h>
+#include "cpmath.h"
+
+// writes binary (P6) PPM files in rectangular parts, every part goes to its place in the file directly,
+// so images larger than the memory (or the maximum texture size) never have to be assembled in one piece
+typedef struct PpmWriter
+{
+    FILE* file;
+    uvec2 size;
+    u64 dataStart;
+    // converted rows of the current part
+    u8* row;
+    u32 rowCapacity;
+    bool failed;
+} PpmWriter;
+
+bool ppmWriter_open(PpmWriter* writer, const char* path, uvec2 size);
+
+// rgba holds the RGBA8 pixels of the part at topLeft (counted from the top left of the image),
+// with its rows from the bottom up if bottomUp is set (like GL images), otherwise from the top down
+void ppmWriter_writeRect(PpmWriter* writer, uvec2 topLeft, uvec2 size, const u8* rgba, bool bottomUp);
+
+// returns false if any part couldn't be written
+bool ppmWriter_close(PpmWriter* writer);
+
+#endif //SIMPLEVOXELTRACER_PPM_WRITER_H
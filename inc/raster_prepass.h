@@ -0,0 +1,30 @@
+#ifndef SIMPLEVOXELTRACER_RASTER_PREPASS_H
+#define SIMPLEVOXELTRACER_RASTER_PREPASS_H
+
+#include "terrain.h"
+#include "gllib.h"
+
+// rasterizes the bounds of all non empty chunks (merged into boxes of 2^n chunks) into a distance image,
+// so every ray can start at the closest box surface of its pixel, pixels without any box don't need to be traced at all
+// only the boxes on the surface of the filled volume are drawn, a ray always enters the volume through one of them
+
+void rasterPrepass_init(void);
+
+void rasterPrepass_destroy(void);
+
+void rasterPrepass_loadShaders(void);
+
+void rasterPrepass_freeShaders(void);
+
+// the boxes are rebuilt from the top level array before the next draw (the terrain changed)
+void rasterPrepass_invalidate(void);
+
+// draws the distance (in blocks, minus one for safety) along the ray of every pixel to the closest box into the R32F target,
+// pixels without any box are set to RASTER_PREPASS_NO_BOX, the viewport is left at the size of the target
+// returns false without drawing, if the distances wouldn't be conservative (the camera is inside of a box or the boxes are outdated)
+bool rasterPrepass_draw(const Terrain* terrain, const Texture* target, u32 width, u32 height, vec3 camPos, mat4 viewProjMat);
+
+// has to match initial.glsl
+#define RASTER_PREPASS_NO_BOX 1e20f
+
+#endif //SIMPLEVOXELTRACER_RASTER_PREPASS_H
@@ -0,0 +1,23 @@
+#ifndef SIMPLEVOXELTRACER_RENDER_SERVER_H
+#define SIMPLEVOXELTRACER_RENDER_SERVER_H
+
+#include "graphics.h"
+
+// serves render jobs over a Unix domain socket or TCP (see socket_address.h), so a pipeline can render many images without starting a process per image
+// jobs that arrive within a few milliseconds of each other are traced together with graphics_drawViews
+//
+// every job is one line of text:
+//   RENDER <width> <height> <camX> <camY> <camZ> <forwardX> <forwardY> <forwardZ> [fov] [raw|ppm] [crop <full width> <full height> <left> <top>]
+// with crop, only the given part of an image of the full size is traced (used to split images into tiles, see tile_coordinator.h)
+// and is answered with one line followed by the image data (top row first):
+//   OK <width> <height> <raw|ppm> <byte count>
+// or just a line with the reason, if the job was rejected:
+//   ERR <message>
+// raw images are RGBA8, ppm images are binary (P6) PPM files including their header
+// a connection can send any number of jobs, the answers arrive in the same order
+
+// blocks until the window is closed or the process receives SIGINT / SIGTERM
+// returns false if the socket couldn't be opened
+bool renderServer_run(Terrain* terrain, const char* address, const RenderSettings* settings);
+
+#endif //SIMPLEVOXELTRACER_RENDER_SERVER_H
@@ -0,0 +1,22 @@
+#ifndef SIMPLEVOXELTRACER_SOCKET_ADDRESS_H
+#define SIMPLEVOXELTRACER_SOCKET_ADDRESS_H
+
+#include "cpmath.h"
+
+// addresses of the render server (see render_server.h) and its workers (see tile_coordinator.h) are either
+// the path of a Unix domain socket, for processes on the same machine, e.g. /tmp/worker0.sock
+// or <host>:<port> for TCP, so the workers can run on other machines, e.g. render-node-3:7000
+// a server listens on all interfaces if the host is left out (:7000)
+// only available on platforms with POSIX sockets
+
+// returns a non blocking listening socket, -1 if it couldn't be opened (the reason is logged)
+int socketAddress_listen(const char* address, int backlog);
+
+// returns a blocking connected socket, -1 with errno set if the connection failed
+// ECONNREFUSED and ENOENT mean that nobody listens on the address (yet)
+int socketAddress_connect(const char* address);
+
+// removes the socket file of a Unix domain socket after its listening socket was closed
+void socketAddress_release(const char* address);
+
+#endif //SIMPLEVOXELTRACER_SOCKET_ADDRESS_H
@@ -4,6 +4,11 @@
 #include "cpmath.h"
 #include "pool_allocator.h"
 
+// downsampled versions of a chunk used for tracing far away terrain (see terrain_buildChunkMips):
+// words 0-15: 4x4x4 block IDs, words 16-17: 2x2x2 block IDs, words 18-19: 4x4x4 occupancy bits
+// cells are ordered like the blocks in a chunk (x, z, y), one byte per block ID, occupancy bits start at the LSB
+#define CHUNK_MIP_WORDS 20
+
 typedef struct Terrain {
     // top level array holding info about each 8x8x8 chunk:
     // leading 00 : chunk is empty and the next 30 bits are used for the distance field value (GPU memory only)
@@ -23,6 +28,10 @@ typedef struct Terrain {
     u32 chunkCount;
 
     bool dirty;
+
+    // range of pool indices that were written since the pools were last uploaded
+    u32 dirtyPoolBegin;
+    u32 dirtyPoolEnd;
 } Terrain;
 
 void terrain_init(Terrain* terrain, u32 width, u32 height);
@@ -33,4 +42,7 @@ void terrain_setBlock(Terrain* terrain, u32 x, u32 y, u32 z, u8 value);
 
 u8 terrain_getBlock(Terrain* terrain, u32 x, u32 y, u32 z);
 
+// each mip cell holds the most common non empty block ID of the cells (blocks) it covers
+void terrain_buildChunkMips(const Terrain* terrain, u32 poolIdx, u32* mips);
+
 #endif //SIMPLEVOXELTRACER_TERRAIN_H
@@ -0,0 +1,23 @@
+#ifndef SIMPLEVOXELTRACER_TILE_COORDINATOR_H
+#define SIMPLEVOXELTRACER_TILE_COORDINATOR_H
+
+#include "cpmath.h"
+
+#define TILE_COORDINATOR_MAX_WORKERS 64
+
+// splits one large image into tiles and traces them on render servers (see render_server.h), e.g. on two other machines
+//   node1$ SimpleVoxelTracer 2048 --serve :7000
+//   node2$ SimpleVoxelTracer 2048 --serve :7000
+//   SimpleVoxelTracer 2048 --workers node1:7000,node2:7000 --image-size 16384x8192 --output image.ppm
+// workers on the same machine can use Unix domain sockets as well (see socket_address.h), e.g. --serve /tmp/worker0.sock
+// the terrain is generated from fixed seeds, so all workers started with the same width trace the same world
+//
+// tiles are handed out as the workers finish their previous ones, so a worker that gets expensive tiles simply takes fewer of them
+// the tiles of a worker that can't be reached or drops out are traced by the remaining ones
+// the coordinator doesn't need a GL context, it only writes the tiles into a binary PPM file (see ppm_writer.h)
+
+// waits for the workers to come up, returns false if no worker is left before all tiles are traced or the file couldn't be written
+bool tileCoordinator_render(const char* const* workerAddresses, u32 workerCount, uvec2 size, vec3 camPos, vec3 forward,
+                            const char* outputPath);
+
+#endif //SIMPLEVOXELTRACER_TILE_COORDINATOR_H
@@ -0,0 +1,15 @@
+#ifndef SIMPLEVOXELTRACER_TILED_CAPTURE_H
+#define SIMPLEVOXELTRACER_TILED_CAPTURE_H
+
+#include "graphics.h"
+
+// the largest part of the image that is traced at once
+#define TILED_CAPTURE_TILE_SIZE 2048
+
+// traces an image of any size (like 32k screenshots) tile by tile with graphics_drawViews and writes every tile into a binary PPM file
+// right away, so the memory needed stays at one tile no matter how large the image is
+// the tiles are parts of one projection, so the image looks exactly like it was traced at once
+// returns false if the file couldn't be written
+bool tiledCapture_capture(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings, uvec2 size, const char* path);
+
+#endif //SIMPLEVOXELTRACER_TILED_CAPTURE_H
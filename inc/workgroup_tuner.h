@@ -0,0 +1,24 @@
+#ifndef SIMPLEVOXELTRACER_WORKGROUP_TUNER_H
+#define SIMPLEVOXELTRACER_WORKGROUP_TUNER_H
+
+#include "cpmath.h"
+
+#define WORKGROUP_CANDIDATE_COUNT 4
+
+// shapes that are benchmarked, 8x8 and 64x1 have 64 invocations, 16x8 and 32x4 have 128,
+// so the tuner picks the group size along with the shape
+extern const uvec2 WORKGROUP_CANDIDATES[WORKGROUP_CANDIDATE_COUNT];
+
+// issues the GPU work that is timed (e.g. one full pass) with the given workgroup size
+typedef void (*WorkGroupBenchFunc)(uvec2 workGroupSize, void* userData);
+
+// loads the winners of earlier runs on this renderer, call once after the context was created
+void workGroupTuner_init(void);
+
+void workGroupTuner_destroy(void);
+
+// returns the cached winner for the key (e.g. pass name + world size) or benchmarks all candidates and caches the fastest one
+// the results are stored on disk per GL_RENDERER, since the best shape depends on the GPU
+uvec2 workGroupTuner_get(const char* key, WorkGroupBenchFunc bench, void* userData);
+
+#endif //SIMPLEVOXELTRACER_WORKGROUP_TUNER_H
@@ -0,0 +1,132 @@
+#version 460
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// fills the pixels initial.glsl (with CHECKERBOARD) didn't trace this frame, in place
+// a pixel takes its color from the previous frame, if the hit found there reprojects back onto it,
+// otherwise it blends the traced pixels around it that lie on the same surface as the closest one
+// only traced pixels are read, so no pixel is read and written by different invocations
+
+layout(rgba8, binding = 0) uniform coherent image2D colorImage;
+layout(rg32f, binding = 1) uniform coherent image2D depthImage;
+
+// resolved color and depth of the previous frame
+layout(rgba8, binding = 2) uniform readonly image2D prevColorImage;
+layout(rg32f, binding = 3) uniform readonly image2D prevDepthImage;
+
+uniform uvec2 screenSize;
+uniform uint traceFrame;
+uniform float peripheryRadius;
+
+uniform vec3 camPos;
+uniform mat4 invViewMat;
+uniform mat4 invProjMat;
+uniform mat4 viewProjMat;
+
+// only set if the previous frame is still valid (the terrain and resolution didn't change)
+uniform bool historyValid;
+uniform vec3 prevCamPos;
+uniform mat4 prevInvViewMat;
+uniform mat4 prevInvProjMat;
+uniform mat4 prevViewProjMat;
+
+// relative depth difference up to which two pixels are considered to be on the same surface
+const float DEPTH_TOLERANCE = 0.02f;
+
+// has to match initial.glsl
+bool isTraced(ivec2 pixel)
+{
+    if (((uint(pixel.x + pixel.y) + traceFrame) & 1u) != 0)
+        return false;
+
+    vec2 offset = (vec2(pixel) + 0.5f - vec2(screenSize) * 0.5f) / (screenSize.y * 0.5f);
+    return length(offset) <= peripheryRadius || ((uint(pixel.y) ^ (traceFrame >> 1)) & 1u) == 0;
+}
+
+vec3 getRayDir(vec2 screenPos, mat4 viewMat, mat4 projMat)
+{
+    vec2 screenSpace = screenPos / vec2(screenSize);
+    vec4 clipSpace = vec4(screenSpace * 2.0f - 1.0f, -1.0, 1.0);
+    vec4 eyeSpace = vec4(vec2(projMat * clipSpace), -1.0, 0.0);
+    return normalize(vec3(viewMat * eyeSpace));
+}
+
+// returns false if the point is behind the camera or outside of the screen
+bool project(mat4 matrix, vec3 point, out ivec2 pixel)
+{
+    vec4 clipSpace = matrix * vec4(point, 1);
+    vec2 screenSpace = clipSpace.xy / clipSpace.w * 0.5f + 0.5f;
+    pixel = ivec2(floor(screenSpace * vec2(screenSize)));
+    return clipSpace.w > 0 && all(greaterThanEqual(screenSpace, vec2(0))) && all(lessThan(screenSpace, vec2(1)));
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, screenSize)) || isTraced(pixel))
+        return;
+
+    // the closest traced neighbour decides on the surface, the 3x3 neighbourhood contains a traced pixel even in the periphery
+    vec2 refDepth = vec2(1e30f, 0);
+    float maxDepth = 0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+        {
+            ivec2 neighbour = pixel + ivec2(x, y);
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(screenSize))) || !isTraced(neighbour))
+                continue;
+
+            vec2 depth = imageLoad(depthImage, neighbour).xy;
+            if (depth.x < refDepth.x)
+                refDepth = depth;
+            maxDepth = max(maxDepth, depth.x);
+        }
+
+    // only happens in the corners of the screen, the pixel keeps its old value
+    if (refDepth.x >= 1e30f)
+        return;
+
+    if (historyValid && refDepth.x < 1e19f)
+    {
+        // the neighbour depth is only a guess for where the pixel was in the previous frame,
+        // the history is only used if its hit lands on this pixel again and isn't hidden behind the traced neighbours
+        vec3 guess = camPos + getRayDir(vec2(pixel) + 0.5f, invViewMat, invProjMat) * refDepth.x;
+        ivec2 prevPixel;
+        if (project(prevViewProjMat, guess, prevPixel))
+        {
+            vec2 prevDepth = imageLoad(prevDepthImage, prevPixel).xy;
+            vec3 prevHit = prevCamPos + getRayDir(vec2(prevPixel) + 0.5f, prevInvViewMat, prevInvProjMat) * prevDepth.x;
+            float depth = distance(camPos, prevHit);
+
+            ivec2 reprojected;
+            if (prevDepth.x < 1e19f && project(viewProjMat, prevHit, reprojected) && reprojected == pixel
+                && depth <= maxDepth * (1 + DEPTH_TOLERANCE))
+            {
+                imageStore(colorImage, pixel, imageLoad(prevColorImage, prevPixel));
+                imageStore(depthImage, pixel, vec4(depth, prevDepth.y, 0, 0));
+                return;
+            }
+        }
+    }
+
+    vec3 color = vec3(0);
+    float weightSum = 0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+        {
+            ivec2 neighbour = pixel + ivec2(x, y);
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(screenSize))) || !isTraced(neighbour))
+                continue;
+
+            vec2 depth = imageLoad(depthImage, neighbour).xy;
+            if (depth.y != refDepth.y || abs(depth.x - refDepth.x) > refDepth.x * DEPTH_TOLERANCE)
+                continue;
+
+            // direct neighbours are closer than diagonal ones
+            float weight = x == 0 || y == 0 ? 1.0f : 0.5f;
+            color += imageLoad(colorImage, neighbour).rgb * weight;
+            weightSum += weight;
+        }
+
+    imageStore(colorImage, pixel, vec4(color / weightSum, 1));
+    imageStore(depthImage, pixel, vec4(refDepth, 0, 0));
+}
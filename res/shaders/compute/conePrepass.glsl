@@ -0,0 +1,94 @@
+#version 460
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// traces one cone per tile of CONE_TILE_SIZE x CONE_TILE_SIZE pixels through the distance field of the top level array
+// the cone contains all rays of the tile, so the distance it reaches is empty for every one of them
+// initial.glsl (with CONE_PREPASS) starts its rays at this distance
+
+// has to match graphics.c
+#define CONE_TILE_SIZE 8
+
+// the cone is only advanced while a step covers at least this many blocks
+const float MIN_CONE_STEP = 1.0f;
+const uint MAX_CONE_STEPS = 128;
+
+layout(std430, binding = 0) readonly buffer top_level_array
+{
+    uint topLevelArray[];
+};
+
+// distance along the rays of each tile that is known to be empty
+layout(r32f, binding = 4) uniform writeonly image2D tileStart;
+
+uniform uvec2 screenSize;
+uniform uvec3 terrainSize;
+uniform vec3 camPos;
+uniform mat4 invViewMat;
+uniform mat4 invProjMat;
+
+// metric of the distance field (0 = manhattan, 1 = euclidean)
+uniform uint dfMode;
+
+uint getChunkIdx(uvec3 pos)
+{
+    uint superChunkIdx = (((pos.x >> 4) * (terrainSize.z >> 4) + (pos.z >> 4)) * (terrainSize.y >> 4) + (pos.y >> 4));
+    uint withinSuperChunkIdx = ((((pos.x >> 3) & 1u) << 2) + (((pos.z >> 3) & 1u) << 1) + ((pos.y >> 3) & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+vec3 getRayDir(vec2 screenPos)
+{
+    vec2 screenSpace = screenPos / vec2(screenSize);
+    vec4 clipSpace = vec4(screenSpace * 2.0f - 1.0f, -1.0, 1.0);
+    vec4 eyeSpace = vec4(vec2(invProjMat * clipSpace), -1.0, 0.0);
+    return normalize(vec3(invViewMat * eyeSpace));
+}
+
+// radius of a sphere around the position that is known to be empty
+float getEmptyRadius(vec3 pos)
+{
+    // outside of the volume everything is empty up to the volume itself
+    vec3 outside = max(max(-pos, pos - vec3(terrainSize)), vec3(0));
+    if (any(greaterThan(outside, vec3(0))))
+        return length(outside);
+
+    uint chunkVal = topLevelArray[getChunkIdx(uvec3(pos))];
+    if (chunkVal >> 30u != 0)
+        return 0;
+
+    // the general value (the lower 15 bits) considers filled chunks in all directions, 2 chunks are subtracted like in initial.glsl
+    float dfValue = float((chunkVal & 0x7FFFu) << 3) - 16;
+
+    // a manhattan distance only guarantees a sphere of 1 / sqrt(3) its size
+    return dfMode == 1 ? dfValue * 0.9999f : dfValue * 0.577f;
+}
+
+void main()
+{
+    uvec2 tileCount = (screenSize + CONE_TILE_SIZE - 1) / CONE_TILE_SIZE;
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, tileCount)))
+        return;
+
+    // the cone axis goes through the center of the tile, its opening angle covers the rays of the corner pixels
+    vec2 tileMin = vec2(gl_GlobalInvocationID.xy * CONE_TILE_SIZE) + 0.5f;
+    vec2 tileMax = min(tileMin + CONE_TILE_SIZE - 1, vec2(screenSize) - 0.5f);
+    vec3 axis = getRayDir((tileMin + tileMax) * 0.5f);
+
+    float cosAngle = min(min(dot(axis, getRayDir(tileMin)), dot(axis, getRayDir(tileMax))),
+                         min(dot(axis, getRayDir(vec2(tileMin.x, tileMax.y))), dot(axis, getRayDir(vec2(tileMax.x, tileMin.y)))));
+    float tanAngle = sqrt(max(1 - cosAngle * cosAngle, 0)) / cosAngle;
+
+    // a step of d along the axis stays inside the empty sphere around the current position,
+    // if d plus the radius of the cone at the end of the step doesn't exceed the radius of the sphere
+    float t = 0;
+    for (uint i = 0; i < MAX_CONE_STEPS; i++)
+    {
+        float step = (getEmptyRadius(camPos + axis * t) - t * tanAngle) / (1 + tanAngle);
+        if (step < MIN_CONE_STEP)
+            break;
+        t += step;
+    }
+
+    // every ray of the tile is at most as long as the axis up to the same depth, so t is safe for all of them
+    imageStore(tileStart, ivec2(gl_GlobalInvocationID.xy), vec4(max(t - 1.0f, 0), 0, 0, 0));
+}
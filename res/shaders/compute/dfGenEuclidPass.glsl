@@ -0,0 +1,155 @@
+#version 450 core
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+
+layout(std430, binding = 0) buffer top_level_array
+{
+    uint topLevelArray[];
+};
+
+// one entry per chunk, every line only ever touches the entries of its own chunks
+layout(std430, binding = 3) buffer df_scratch
+{
+    uint scratch[];
+};
+
+layout(location=0) uniform uvec3 terrainSize;
+
+// axis the lines of this pass run along (0 = X, 2 = Z)
+layout(location=2) uniform uint lineAxis;
+
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
+uint getChunkIdx(uvec3 pos)
+{
+    uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
+    uint withinSuperChunkIdx = (((pos.x & 1u) << 2) + ((pos.z & 1u) << 1) + (pos.y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+uint getLineChunkIdx(int i)
+{
+    if (lineAxis == 0)
+        return getChunkIdx(uvec3(i, lineId.x, lineId.y));
+    else
+        return getChunkIdx(uvec3(lineId.x, lineId.y, i));
+}
+
+int readSquaredDistance(int i)
+{
+    uint value = topLevelArray[getLineChunkIdx(i)];
+    if (value >> 30 == 0)
+        return int(value);
+    else
+        return 0; // chunk is filled
+}
+
+int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+// position at which the parabola rooted at u starts to be lower than the one rooted at i (i < u)
+int sep(int i, int u, int gi, int gu)
+{
+    return floorDiv(u * u - i * i + gu - gi, 2 * (u - i));
+}
+
+void main()
+{
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
+    /*
+    * Exact squared euclidean distance transform along one axis (Meijster et al.).
+    * The lower envelope of the parabolas (x - i)^2 + g(i) is kept as a stack in the scratch buffer,
+    * each entry packs the root of the parabola (low 16 bits) and the start of its segment (high 16 bits).
+    */
+    int lineLength = int(terrainSize[lineAxis] >> 3);
+
+    int q = 0;
+    int s = 0;
+    int t = 0;
+    int gs = readSquaredDistance(0);
+    scratch[getLineChunkIdx(0)] = 0;
+
+    for (int u = 1; u < lineLength; u++)
+    {
+        int gu = readSquaredDistance(u);
+
+        // pop every parabola that is above the new one at the start of its segment
+        while (q >= 0 && (t - s) * (t - s) + gs > (t - u) * (t - u) + gu)
+        {
+            q--;
+            if (q >= 0)
+            {
+                uint entry = scratch[getLineChunkIdx(q)];
+                s = int(entry & 0xFFFFu);
+                t = int(entry >> 16);
+                gs = readSquaredDistance(s);
+            }
+        }
+
+        if (q < 0)
+        {
+            q = 0;
+            s = u;
+            t = 0;
+            gs = gu;
+            scratch[getLineChunkIdx(0)] = uint(u);
+        }
+        else
+        {
+            int w = 1 + sep(s, u, gs, gu);
+            if (w < lineLength)
+            {
+                q++;
+                s = u;
+                t = w;
+                gs = gu;
+                scratch[getLineChunkIdx(q)] = uint(u) | (uint(w) << 16);
+            }
+        }
+    }
+
+    // walk the envelope backwards, the result of u overwrites stack entry u which is never read again
+    for (int u = lineLength - 1; u >= 0; u--)
+    {
+        scratch[getLineChunkIdx(u)] = uint((u - s) * (u - s) + gs);
+        if (u == t)
+        {
+            q--;
+            if (q >= 0)
+            {
+                uint entry = scratch[getLineChunkIdx(q)];
+                s = int(entry & 0xFFFFu);
+                t = int(entry >> 16);
+                gs = readSquaredDistance(s);
+            }
+        }
+    }
+
+    // write back the results of all empty chunks
+    for (int u = 0; u < lineLength; u++)
+    {
+        uint idx = getLineChunkIdx(u);
+        if (topLevelArray[idx] >> 30 == 0)
+            topLevelArray[idx] = scratch[idx];
+    }
+}
@@ -0,0 +1,166 @@
+#version 450 core
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+
+layout(std430, binding = 0) buffer top_level_array
+{
+    uint topLevelArray[];
+};
+
+// one entry per chunk, every column only ever touches the entries of its own chunks
+layout(std430, binding = 3) buffer df_scratch
+{
+    uint scratch[];
+};
+
+layout(location=0) uniform uvec3 terrainSize;
+
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
+uint getChunkIdx(uvec3 pos)
+{
+    uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
+    uint withinSuperChunkIdx = (((pos.x & 1u) << 2) + ((pos.z & 1u) << 1) + (pos.y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+uint getColumnChunkIdx(int y)
+{
+    return getChunkIdx(uvec3(lineId.x, y, lineId.y));
+}
+
+int readSquaredDistance(int y)
+{
+    uint value = topLevelArray[getColumnChunkIdx(y)];
+    if (value >> 30 == 0)
+        return int(value);
+    else
+        return 0; // chunk is filled
+}
+
+int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+// position at which the parabola rooted at u starts to be lower than the one rooted at i (i < u)
+int sep(int i, int u, int gi, int gu)
+{
+    return floorDiv(u * u - i * i + gu - gi, 2 * (u - i));
+}
+
+// rounds down, so the stored distance never exceeds the real one
+uint floorSqrt(uint value)
+{
+    uint root = uint(sqrt(float(value)));
+    while (root * root > value)
+        root--;
+    return min(root, 0x7FFFu);
+}
+
+void main()
+{
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
+    /*
+    * Final pass of the euclidean distance field, this mirrors the Y pass of the manhattan distance field.
+    * The 15 least significant bits hold the (rounded down) euclidean distance,
+    * the next 15 bits hold the distance to the nearest filled chunk that is at the same height or ABOVE,
+    * so rays that travel in +Y direction can use the potentially larger second value.
+    */
+    int columnHeight = int(terrainSize.y >> 3);
+
+    // same lower envelope construction as in the X and Z passes
+    int q = 0;
+    int s = 0;
+    int t = 0;
+    int gs = readSquaredDistance(0);
+    scratch[getColumnChunkIdx(0)] = 0;
+
+    for (int u = 1; u < columnHeight; u++)
+    {
+        int gu = readSquaredDistance(u);
+
+        while (q >= 0 && (t - s) * (t - s) + gs > (t - u) * (t - u) + gu)
+        {
+            q--;
+            if (q >= 0)
+            {
+                uint entry = scratch[getColumnChunkIdx(q)];
+                s = int(entry & 0xFFFFu);
+                t = int(entry >> 16);
+                gs = readSquaredDistance(s);
+            }
+        }
+
+        if (q < 0)
+        {
+            q = 0;
+            s = u;
+            t = 0;
+            gs = gu;
+            scratch[getColumnChunkIdx(0)] = uint(u);
+        }
+        else
+        {
+            int w = 1 + sep(s, u, gs, gu);
+            if (w < columnHeight)
+            {
+                q++;
+                s = u;
+                t = w;
+                gs = gu;
+                scratch[getColumnChunkIdx(q)] = uint(u) | (uint(w) << 16);
+            }
+        }
+    }
+
+    for (int u = columnHeight - 1; u >= 0; u--)
+    {
+        scratch[getColumnChunkIdx(u)] = uint((u - s) * (u - s) + gs);
+        if (u == t)
+        {
+            q--;
+            if (q >= 0)
+            {
+                uint entry = scratch[getColumnChunkIdx(q)];
+                s = int(entry & 0xFFFFu);
+                t = int(entry >> 16);
+                gs = readSquaredDistance(s);
+            }
+        }
+    }
+
+    // write back bottom to top, so the chunks above the current one still hold their input values
+    for (int u = 0; u < columnHeight; u++)
+    {
+        uint idx = getColumnChunkIdx(u);
+        if (topLevelArray[idx] >> 30 != 0)
+            continue;
+
+        // the upper value only considers chunks at the same height or above
+        // columns are short, so a brute force search that stops once the height difference alone is too large is fine
+        int upper = readSquaredDistance(u);
+        for (int y = u + 1; y < columnHeight && (y - u) * (y - u) < upper; y++)
+            upper = min(upper, (y - u) * (y - u) + readSquaredDistance(y));
+
+        topLevelArray[idx] = (floorSqrt(uint(upper)) << 15) | floorSqrt(scratch[idx]);
+    }
+}
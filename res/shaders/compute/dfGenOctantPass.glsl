@@ -0,0 +1,126 @@
+#version 450 core
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+
+layout(std430, binding = 0) readonly buffer top_level_array
+{
+    uint topLevelArray[];
+};
+
+// 8 bytes per chunk, one manhattan distance (in chunks, capped at 255) per ray octant
+// octant bits: 1 = +X, 2 = +Y, 4 = +Z, the first uint holds the octants towards -Z
+layout(std430, binding = 4) buffer octant_distance_field
+{
+    uint octantDF[];
+};
+
+layout(location=0) uniform uvec3 terrainSize;
+
+// axis the lines of this pass run along (0 = X, 1 = Y, 2 = Z)
+// the Z pass runs first and seeds the field from the top level array
+layout(location=2) uniform uint lineAxis;
+
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
+uint getChunkIdx(uvec3 pos)
+{
+    uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
+    uint withinSuperChunkIdx = (((pos.x & 1u) << 2) + ((pos.z & 1u) << 1) + (pos.y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+uint getLineChunkIdx(int i)
+{
+    if (lineAxis == 0)
+        return getChunkIdx(uvec3(i, lineId.x, lineId.y));
+    if (lineAxis == 1)
+        return getChunkIdx(uvec3(lineId.x, i, lineId.y));
+    return getChunkIdx(uvec3(lineId.x, lineId.y, i));
+}
+
+uvec2 readValues(uint idx)
+{
+    if (lineAxis == 2)
+        return (topLevelArray[idx] >> 30) != 0 ? uvec2(0) : uvec2(0xFFFFFFFFu);
+    return uvec2(octantDF[idx << 1], octantDF[(idx << 1) + 1]);
+}
+
+// limits the distance of every octant selected by the mask to the previous distance + 1
+uvec2 spreadValues(uvec2 values, uvec2 prevValues, uint octantMask)
+{
+    for (uint octant = 0; octant < 8; octant++)
+    {
+        if ((octantMask & (1u << octant)) == 0)
+            continue;
+
+        uint word = octant >> 2;
+        uint shift = (octant & 3u) << 3;
+        uint value = (values[word] >> shift) & 0xFFu;
+        uint prevValue = (prevValues[word] >> shift) & 0xFFu;
+        if (prevValue + 1 < value)
+            values[word] = (values[word] & ~(0xFFu << shift)) | ((prevValue + 1) << shift);
+    }
+    return values;
+}
+
+void main()
+{
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
+    /*
+    * A ray can only ever reach chunks that lie in the octant of its direction (relative to the current chunk).
+    * Each octant therefore gets its own distance field, which only considers filled chunks in that octant.
+    * This generalizes the upward split of the Y pass to all axes:
+    * sweeping towards +axis spreads distances to rays travelling in -axis direction and vice versa.
+    */
+    uint axisBit = 1u << lineAxis;
+
+    // octants whose rays travel in -axis / +axis direction
+    uint negativeOctants = 0;
+    for (uint octant = 0; octant < 8; octant++)
+        if ((octant & axisBit) == 0)
+            negativeOctants |= 1u << octant;
+    uint positiveOctants = ~negativeOctants & 0xFFu;
+
+    int lineLength = int(terrainSize[lineAxis] >> 3);
+
+    uint idx = getLineChunkIdx(0);
+    uvec2 prevValues = readValues(idx);
+    octantDF[idx << 1] = prevValues.x;
+    octantDF[(idx << 1) + 1] = prevValues.y;
+
+    for (int i = 1; i < lineLength; i++)
+    {
+        idx = getLineChunkIdx(i);
+        uvec2 values = spreadValues(readValues(idx), prevValues, negativeOctants);
+        octantDF[idx << 1] = values.x;
+        octantDF[(idx << 1) + 1] = values.y;
+        prevValues = values;
+    }
+
+    for (int i = lineLength - 2; i >= 0; i--)
+    {
+        idx = getLineChunkIdx(i);
+        uvec2 values = spreadValues(uvec2(octantDF[idx << 1], octantDF[(idx << 1) + 1]), prevValues, positiveOctants);
+        octantDF[idx << 1] = values.x;
+        octantDF[(idx << 1) + 1] = values.y;
+        prevValues = values;
+    }
+}
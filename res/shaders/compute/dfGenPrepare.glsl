@@ -1,5 +1,14 @@
 #version 450 core
-layout(local_size_x = 8, local_size_y = 8) in;
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
 
 layout(std430, binding = 0) buffer top_level_array
 {
@@ -8,6 +17,18 @@ layout(std430, binding = 0) buffer top_level_array
 
 layout(location=0) uniform uvec3 terrainSize;
 
+// value every empty chunk starts out with (depends on the distance metric that is built afterwards)
+layout(location=1) uniform uint emptyValue;
+
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
 uint getChunkIdx(uvec3 pos)
 {
     uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
@@ -22,13 +43,17 @@ bool isChunkFilled(uint idx)
 
 void main()
 {
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
     for (uint y = 0; y < (terrainSize.y >> 3); y++)
     {
-        uint idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, y, gl_GlobalInvocationID.y));
+        uint idx = getChunkIdx(uvec3(lineId.x, y, lineId.y));
         if (!isChunkFilled(idx))
         {
             // initialize every empty chunk with the max distance value
-            topLevelArray[idx] = 0xFFF;
+            topLevelArray[idx] = emptyValue;
         }
     }
 }
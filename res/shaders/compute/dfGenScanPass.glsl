@@ -0,0 +1,141 @@
+#version 450 core
+layout(local_size_x = 256) in;
+
+// lines of up to 2048 chunks are supported (8 chunks per invocation)
+#define MAX_LINE_LENGTH 2048
+#define VALUES_PER_INVOCATION (MAX_LINE_LENGTH / 256)
+
+layout(std430, binding = 0) buffer top_level_array
+{
+    uint topLevelArray[];
+};
+
+layout(location=0) uniform uvec3 terrainSize;
+
+// axis the lines of this pass run along (0 = X, 1 = Y, 2 = Z)
+// the Y pass runs last and packs both DF values like dfGenYPass.glsl
+layout(location=2) uniform uint lineAxis;
+
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// the two coordinates of the line this workgroup works on
+uvec2 lineId;
+
+shared uint lineValues[MAX_LINE_LENGTH];
+shared uint upperValues[MAX_LINE_LENGTH];
+
+uint getChunkIdx(uvec3 pos)
+{
+    uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
+    uint withinSuperChunkIdx = (((pos.x & 1u) << 2) + ((pos.z & 1u) << 1) + (pos.y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+uint getLineChunkIdx(uint i)
+{
+    if (lineAxis == 0)
+        return getChunkIdx(uvec3(i, lineId.x, lineId.y));
+    if (lineAxis == 1)
+        return getChunkIdx(uvec3(lineId.x, i, lineId.y));
+    return getChunkIdx(uvec3(lineId.x, lineId.y, i));
+}
+
+uint readDistanceValue(uint idx)
+{
+    uint value = topLevelArray[idx];
+    if (value >> 30 == 0)
+        return value << 2 >> 2;
+    else
+        return 0; // chunk is filled
+}
+
+// min-plus scan over the shared line with doubling offsets:
+// after the step with offset k, every value considers all chunks closer than 2k (in the enabled directions)
+void spread(uint lineLength, bool fromBelow, bool fromAbove)
+{
+    for (uint offset = 1; offset < lineLength; offset <<= 1)
+    {
+        uint newValues[VALUES_PER_INVOCATION];
+        for (uint k = 0; k < VALUES_PER_INVOCATION; k++)
+        {
+            uint i = gl_LocalInvocationID.x + k * 256;
+            if (i >= lineLength)
+                break;
+
+            uint value = lineValues[i];
+            if (fromBelow && i >= offset)
+                value = min(value, lineValues[i - offset] + offset);
+            if (fromAbove && i + offset < lineLength)
+                value = min(value, lineValues[i + offset] + offset);
+            newValues[k] = value;
+        }
+
+        barrier();
+
+        for (uint k = 0; k < VALUES_PER_INVOCATION; k++)
+        {
+            uint i = gl_LocalInvocationID.x + k * 256;
+            if (i >= lineLength)
+                break;
+            lineValues[i] = newValues[k];
+        }
+
+        barrier();
+    }
+}
+
+void main()
+{
+    lineId = gl_WorkGroupID.xy + sliceOffset;
+
+    /*
+    * Replacement for the serial sweeps of the X, Y and Z passes with one workgroup per line.
+    * The serial forward and backward sweeps compute min(value(i) + |x - i|) over the whole line,
+    * which is done here in log2(line length) steps in shared memory.
+    * The output is bit for bit identical to the sweep passes.
+    */
+    uint lineLength = terrainSize[lineAxis] >> 3;
+
+    for (uint i = gl_LocalInvocationID.x; i < lineLength; i += 256)
+        lineValues[i] = readDistanceValue(getLineChunkIdx(i));
+
+    barrier();
+
+    if (lineAxis != 1)
+    {
+        spread(lineLength, true, true);
+
+        for (uint i = gl_LocalInvocationID.x; i < lineLength; i += 256)
+        {
+            uint idx = getLineChunkIdx(i);
+            if (topLevelArray[idx] >> 30 == 0)
+                topLevelArray[idx] = lineValues[i];
+        }
+        return;
+    }
+
+    // the upper value only considers filled chunks at the same height or above (the -Y sweep)
+    spread(lineLength, false, true);
+
+    for (uint i = gl_LocalInvocationID.x; i < lineLength; i += 256)
+        upperValues[i] = min(0x7FFFu, lineValues[i]);
+
+    barrier();
+
+    // the final value is spread from the upper values (the +Y sweep)
+    spread(lineLength, true, false);
+
+    for (uint i = gl_LocalInvocationID.x; i < lineLength; i += 256)
+    {
+        uint idx = getLineChunkIdx(i);
+        if (topLevelArray[idx] >> 30 != 0)
+            continue;
+
+        // the +Y sweep of dfGenYPass.glsl starts above the bottom chunk, which therefore keeps 0 as its final value
+        uint value = upperValues[i] << 15;
+        if (i != 0)
+            value |= min(0x7FFFu, lineValues[i]);
+        topLevelArray[idx] = value;
+    }
+}
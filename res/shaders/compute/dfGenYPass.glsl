@@ -1,5 +1,14 @@
 #version 450 core
-layout(local_size_x = 8, local_size_y = 8) in;
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
 
 layout(std430, binding = 0) buffer top_level_array
 {
@@ -8,6 +17,15 @@ layout(std430, binding = 0) buffer top_level_array
 
 layout(location=0) uniform uvec3 terrainSize;
 
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
 uint getChunkIdx(uvec3 pos)
 {
     uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
@@ -35,6 +53,10 @@ uint readDistanceValueHalf(uint idx)
 
 void main()
 {
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
     /*
     * This pass deviates from the X and Z pass and is ran last.
     * It outputs the normal manhattan distance field value to the least significant 15 bits of the chunk value.
@@ -44,7 +66,7 @@ void main()
     */
 
     // Two axis sweeps (-Y and +Y)
-    uint idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, (terrainSize.y >> 3) - 1, gl_GlobalInvocationID.y));
+    uint idx = getChunkIdx(uvec3(lineId.x, (terrainSize.y >> 3) - 1, lineId.y));
     uint prevValue = readDistanceValueFull(idx);
 
     // move the first distance value 15 bits to the left
@@ -53,7 +75,7 @@ void main()
 
     for (int y = int((terrainSize.y >> 3) - 2); y >= 0; y--)
     {
-        idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, y, gl_GlobalInvocationID.y));
+        idx = getChunkIdx(uvec3(lineId.x, y, lineId.y));
         uint thisValue = readDistanceValueFull(idx);
         prevValue = prevValue + 1 < thisValue ? min(0x7FFF, prevValue + 1) : thisValue;
 
@@ -64,7 +86,7 @@ void main()
 
     for (int y = 1; y < (terrainSize.y >> 3); y++)
     {
-        idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, y, gl_GlobalInvocationID.y));
+        idx = getChunkIdx(uvec3(lineId.x, y, lineId.y));
         uint thisValue = readDistanceValueHalf(idx);
         prevValue = prevValue + 1 < thisValue ? min(0x7FFF, prevValue + 1) : thisValue;
 
@@ -1,5 +1,14 @@
 #version 450 core
-layout(local_size_x = 8, local_size_y = 8) in;
+
+// the workgroup size is tuned per device (see workgroup_tuner.h)
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
 
 layout(std430, binding = 0) buffer top_level_array
 {
@@ -8,6 +17,15 @@ layout(std430, binding = 0) buffer top_level_array
 
 layout(location=0) uniform uvec3 terrainSize;
 
+// offset (in workgroups) of this dispatch, when the pass is split over multiple frames
+layout(location=3) uniform uvec2 sliceOffset;
+
+// number of lines in both directions, the last workgroups may only be partially used
+layout(location=4) uniform uvec2 lineCount;
+
+// the two coordinates of the line this invocation works on
+uvec2 lineId;
+
 uint getChunkIdx(uvec3 pos)
 {
     uint superChunkIdx = (((pos.x >> 1) * (terrainSize.z >> 4) + (pos.z >> 1)) * (terrainSize.y >> 4) + (pos.y >> 1));
@@ -26,13 +44,17 @@ uint readDistanceValue(uint idx)
 
 void main()
 {
+    lineId = gl_GlobalInvocationID.xy + sliceOffset * gl_WorkGroupSize.xy;
+    if (any(greaterThanEqual(lineId, lineCount)))
+        return;
+
     // Two axis sweeps (+Z and -Z)
-    uint idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y, 0));
+    uint idx = getChunkIdx(uvec3(lineId.x, lineId.y, 0));
     uint prevValue = readDistanceValue(idx);
     for (int z = 1; z < (terrainSize.z >> 3); z++)
     {
         // compare current distance value to previous distance value and limit it to previous + 1
-        idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y, z));
+        idx = getChunkIdx(uvec3(lineId.x, lineId.y, z));
         uint thisValue = readDistanceValue(idx);
         if (prevValue + 1 < thisValue)
         {
@@ -45,7 +67,7 @@ void main()
     for (int z = int(terrainSize.z >> 3) - 2; z >= 0; z--)
     {
         // compare current distance value to previous distance value and limit it to previous + 1
-        idx = getChunkIdx(uvec3(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y, z));
+        idx = getChunkIdx(uvec3(lineId.x, lineId.y, z));
         uint thisValue = readDistanceValue(idx);
         if (prevValue + 1 < thisValue)
         {
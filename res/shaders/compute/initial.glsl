@@ -1,14 +1,183 @@
 #version 460
 //#extension GL_ARB_shader_clock : enable
-layout(local_size_x = 8,  local_size_y = 8) in;
+
+// graphics.c compiles a variant of this shader for every combination of the settings below (see gllib_makeComputeVariant)
+// settings that aren't defined fall back to uniforms / defaults, so the shader also compiles on its own
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 8
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 8
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X,  local_size_y = LOCAL_SIZE_Y) in;
 
 layout(rgba8, binding = 0) uniform writeonly image2D outImage;
 
+// WRITE_DEPTH additionally stores the hit distance and face ID of every pixel (used for upsampling reduced resolution traces)
+#ifdef WRITE_DEPTH
+layout(rg32f, binding = 1) uniform writeonly image2D depthImage;
+#endif
+
+// REPROJECT starts the rays just short of the hits of the previous frame (see reproject.glsl)
+#ifdef REPROJECT
+layout(r32ui, binding = 2) uniform readonly uimage2D reprojectedDepth;
+layout(rg32f, binding = 3) uniform readonly image2D prevDepthImage;
+
+uniform vec3 prevCamPos;
+uniform mat4 prevViewProjMat;
+
+// with checkerboard tracing, the depth of the pixels that weren't traced in the previous frame is only a guess (see checkerboardResolve.glsl)
+uniform bool prevCheckerboard;
+uniform uint prevTraceFrame;
+uniform float prevPeripheryRadius;
+
+// the start is pulled in by this factor and a block, so small errors of the reprojection stay in front of the surface
+const float REPROJECT_SAFETY = 0.95f;
+
+// the skipped segment is checked at every pixel it covers in the previous frame,
+// segments that cover more pixels than this start from scratch instead
+const uint REPROJECT_MAX_STEPS = 64;
+
+// the check starts this far from the camera, the camera itself has no position on the previous screen if it didn't move
+const float REPROJECT_NEAR = 0.5f;
+#endif
+
+// CONE_PREPASS starts the rays at the distance the cone of their tile proved to be empty (see conePrepass.glsl)
+#ifdef CONE_PREPASS
+// has to match graphics.c
+#define CONE_TILE_SIZE 8
+
+layout(r32f, binding = 4) uniform readonly image2D tileStart;
+#endif
+
+// RASTER_PREPASS starts the rays at the closest rasterized chunk bounds of their pixel (see raster_prepass.c)
+#ifdef RASTER_PREPASS
+// has to match raster_prepass.h
+#define RASTER_PREPASS_NO_BOX 1e20f
+
+layout(r32f, binding = 5) uniform readonly image2D rasterStart;
+#endif
+
+// GBUFFER stores the hit of every pixel instead of its color: distance (float bits), face ID, block ID and chunk index
+// the chunk index is the index into the top level array, 0xFFFFFFFF for the sky
+#ifdef GBUFFER
+layout(rgba32ui, binding = 6) uniform writeonly uimage2D gBuffer;
+#endif
+
+// PERSISTENT only starts as many workgroups as the GPU can run at once, they take tiles of the screen from a global queue
+#ifdef PERSISTENT
+layout(std430, binding = 6) coherent buffer ray_queue
+{
+    uint nextTile;
+};
+
+// tiles of the (virtual) dispatch grid, a tile has the size of a workgroup
+uniform uvec2 tileCount;
+
+shared uint currentTile;
+#endif
+
+// CHECKERBOARD only traces the pixels of one checkerboard color per frame (see checkerboardResolve.glsl)
+// the dispatch covers half the screen width, every invocation is mapped to a pixel of the current color
+#ifdef CHECKERBOARD
+uniform uint traceFrame;
+
+// beyond this distance from the center (in half screen heights), only one pixel of every 2x2 quad is traced per frame
+uniform float peripheryRadius;
+#endif
+
+// MULTI_VIEW traces a list of cameras into their regions of an atlas in one dispatch (see graphics_drawViews)
+// the camera of every invocation is looked up from the tile it belongs to, only the color is written
+#ifdef MULTI_VIEW
+// has to match GPUView in graphics.c
+struct View
+{
+    mat4 invViewMat;
+    mat4 invProjMat;
+    vec4 camPos;
+    uvec2 offset;
+    uvec2 size;
+    uint firstTile;
+    uint tilesX;
+    float lodFactor;
+    uint padding;
+};
+
+layout(std430, binding = 7) readonly buffer view_list
+{
+    View views[];
+};
+
+uniform uint viewCount;
+uniform uint totalTiles;
+
+// the camera is set per invocation from its view
+uvec2 screenSize;
+vec3 camPos;
+mat4 invViewMat;
+mat4 invProjMat;
+float lodFactor;
+ivec2 outputOffset;
+#else
 uniform uvec2 screenSize;
-uniform uvec3 terrainSize;
 uniform vec3 camPos;
-uniform mat4 viewMat;
-uniform mat4 projMat;
+
+// inverse camera matrices, precomputed on the CPU
+uniform mat4 invViewMat;
+uniform mat4 invProjMat;
+
+// size of a pixel (in blocks) per unit of distance from the camera, scaled by the LOD setting (0 = no LOD)
+uniform float lodFactor;
+
+const ivec2 outputOffset = ivec2(0);
+#endif
+
+#ifdef TERRAIN_SIZE
+const uvec3 terrainSize = TERRAIN_SIZE;
+#else
+uniform uvec3 terrainSize;
+#endif
+
+// metric of the distance field (0 = manhattan, 1 = euclidean)
+#ifdef DF_MODE
+const uint dfMode = DF_MODE;
+#else
+uniform uint dfMode;
+#endif
+
+// whether the per octant distance field is available
+#ifdef USE_OCTANT_DF
+const bool useOctantDF = USE_OCTANT_DF != 0;
+#else
+uniform bool useOctantDF;
+#endif
+
+// whether the chunk pools only hold the bricks of the chunk cache (see chunk_cache.h)
+#ifdef USE_CHUNK_CACHE
+const bool useChunkCache = USE_CHUNK_CACHE != 0;
+#else
+uniform bool useChunkCache;
+#endif
+
+// whether far away chunks can be traced through their mips
+#ifdef USE_LOD
+const bool useLod = USE_LOD != 0;
+#else
+const bool useLod = true;
+#endif
+
+// this counter is set to equal the DF value and incremented each frame
+// the bitmask for chunks is used while this value is below a threshold to be more cache efficient
+// setting it to a high number (e.g. 100) means the DF is always read on the first step
+#ifndef DF_READ_THRESHOLD
+#define DF_READ_THRESHOLD 0
+#endif
+
+// HEATMAP colors every pixel by the number of traversal steps instead of the hit block (see RenderSettings)
+#ifdef HEATMAP
+uint traversalSteps = 0;
+#endif
 
 layout(std430, binding = 0) readonly buffer top_level_array
 {
@@ -25,6 +194,24 @@ layout(std430, binding = 2) readonly buffer chunk_pool_bits
     uint chunkPoolBits[];
 };
 
+// 8 manhattan distances per chunk, one for each ray octant (see dfGenOctantPass.glsl)
+layout(std430, binding = 3) readonly buffer octant_distance_field
+{
+    uint octantDF[];
+};
+
+// brick slot of every chunk pool index, non resident chunks have the highest bit set and their LOD block ID in the lowest byte
+layout(std430, binding = 4) readonly buffer chunk_cache_indirection
+{
+    uint brickIndirection[];
+};
+
+// downsampled chunks, CHUNK_MIP_WORDS (20) per pool index / brick slot (see terrain.h)
+layout(std430, binding = 5) readonly buffer chunk_pool_mips
+{
+    uint chunkMips[];
+};
+
 struct RayHit {
     vec3 hitPos;
     uint hitId;
@@ -51,56 +238,130 @@ uint getChunkIdx(uvec3 pos)
     return (superChunkIdx << 3) + withinSuperChunkIdx;
 }
 
-RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
+// per ray state of the traversal, so a ray can be marched in several parts (see COOPERATIVE)
+struct RayState
 {
-    // delta to avoid grid aligned rays
-    if (rayDir.x == 0)
-        rayDir.x = 0.001;
-    if (rayDir.y == 0)
-        rayDir.y = 0.001;
-    if (rayDir.z == 0)
-        rayDir.z = 0.001;
-
-    rayDir = normalize(rayDir);
+    vec3 dir;
 
     // some helper values used for DDA steps
-    ivec3 raySign = ivec3(sign(rayDir));
-    ivec3 rayPositivity = (1 + raySign) >> 1;
-    vec3 rayInverse = 1 / rayDir;
-
-    float inverseDirY = 1.0f / rayDir.y;
+    ivec3 raySign;
+    ivec3 rayPositivity;
+    vec3 rayInverse;
+    float inverseDirY;
 
     // converting manhattan distance to euclidean is direction dependent,
     // precalculate this factor, since the direction doesn't change
-    float distanceFactor = 0.9999f / dot(rayDir, raySign);
+    // an euclidean distance field can be used as is
+    float distanceFactor;
+    float octantDistanceFactor;
 
-    int minIdx = 1;
-    vec3 t = vec3(1);
+    // the octant DF only considers filled chunks the ray can actually reach, select the value for this direction
+    uint octantWord;
+    uint octantShift;
 
-    // these variables keep track of the current position (rayPos = gridCoords + withinGridCoords)
-    ivec3 gridCoords = ivec3(rayPos);
-    vec3 withinGridCoords = rayPos - gridCoords;
+    int minIdx;
 
-    ivec3 bounds = ivec3(terrainSize);
+    // these variables keep track of the current position (rayPos = gridCoords + withinGridCoords)
+    ivec3 gridCoords;
+    vec3 withinGridCoords;
 
     // this is the step size used for DDA, it's dynamically changed inside the traversal loop
     // the actual number of blocks (NxNxN) that are stepped over is N = 2^stepSize
     // default is single block steps
-    uint stepSize = 0;
+    uint stepSize;
+};
+
+#ifdef COOPERATIVE
+// chunks per axis of the box whose top level array (and octant DF) entries the workgroup stages in shared memory
+#define STAGE_SIZE 8u
+#define STAGE_CHUNKS (STAGE_SIZE * STAGE_SIZE * STAGE_SIZE)
+
+// traversal steps per ray between two restagings of the box
+const uint COOPERATIVE_ROUND_STEPS = 32;
 
-    // the distance field contains 2 values: one general distance value and one that ignores any solid blocks that are BELOW
-    // in the case that rayDir.y > 0, we can
-    uint dfShift = rayDir.y < 0 ? 0 : 15;
+shared uint stagedChunks[STAGE_CHUNKS];
+shared uint stagedOctants[STAGE_CHUNKS * 2];
+shared uvec3 stageOrigin;
 
-   // this counter is set to equal the DF value and incremented each frame
-   // the bitmask for chunks is used while this value is below a threshold to be more cache efficient
-   // setting it to a high number (e.g. 100) means the DF is always read on the first step
-    const uint dfReadThreshold = 0;
+// gathered from the rays that are still marching to place the next box
+shared uint stageLow[3];
+shared uint stageHigh[3];
+shared int stageDirection[3];
+shared uint marchingRays;
+#endif
+
+// the entry of the top level array for the chunk of pos, from shared memory if the workgroup staged it
+uint loadChunkValue(uint chunkIdx, uvec3 pos)
+{
+#ifdef COOPERATIVE
+    // chunks in front of the origin wrap around to large values, so they fail the test as well
+    uvec3 stagePos = (pos >> 3) - stageOrigin;
+    if (all(lessThan(stagePos, uvec3(STAGE_SIZE))))
+        return stagedChunks[(stagePos.x * STAGE_SIZE + stagePos.y) * STAGE_SIZE + stagePos.z];
+#endif
+    return topLevelArray[chunkIdx];
+}
 
-    while ((!any(greaterThanEqual(gridCoords, bounds)) && !any(lessThan(gridCoords, ivec3(0)))))
+uint loadOctantWord(uint chunkIdx, uvec3 pos, uint octantWord)
+{
+#ifdef COOPERATIVE
+    uvec3 stagePos = (pos >> 3) - stageOrigin;
+    if (all(lessThan(stagePos, uvec3(STAGE_SIZE))))
+        return stagedOctants[(((stagePos.x * STAGE_SIZE + stagePos.y) * STAGE_SIZE + stagePos.z) << 1) + octantWord];
+#endif
+    return octantDF[(chunkIdx << 1) + octantWord];
+}
+
+RayState beginRay(vec3 rayPos, vec3 rayDir)
+{
+    // delta to avoid grid aligned rays
+    if (rayDir.x == 0)
+        rayDir.x = 0.001;
+    if (rayDir.y == 0)
+        rayDir.y = 0.001;
+    if (rayDir.z == 0)
+        rayDir.z = 0.001;
+
+    RayState ray;
+    ray.dir = normalize(rayDir);
+
+    ray.raySign = ivec3(sign(ray.dir));
+    ray.rayPositivity = (1 + ray.raySign) >> 1;
+    ray.rayInverse = 1 / ray.dir;
+    ray.inverseDirY = 1.0f / ray.dir.y;
+
+    ray.distanceFactor = dfMode == 1 ? 0.9999f : 0.9999f / dot(ray.dir, ray.raySign);
+    ray.octantDistanceFactor = 0.9999f / dot(ray.dir, ray.raySign);
+
+    ray.octantWord = uint(ray.rayPositivity.z);
+    ray.octantShift = (uint(ray.rayPositivity.x) + (uint(ray.rayPositivity.y) << 1)) << 3;
+
+    ray.minIdx = 1;
+    ray.gridCoords = ivec3(rayPos);
+    ray.withinGridCoords = rayPos - ray.gridCoords;
+    ray.stepSize = 0;
+    return ray;
+}
+
+// takes up to maxSteps traversal steps, returns true once the ray hit a block or left the terrain
+bool marchRay(inout RayState ray, uint maxSteps, inout RayHit hit)
+{
+    ivec3 bounds = ivec3(terrainSize);
+
+    for (uint stepIdx = 0; stepIdx < maxSteps; stepIdx++)
     {
+        if (any(greaterThanEqual(ray.gridCoords, bounds)) || any(lessThan(ray.gridCoords, ivec3(0))))
+        {
+            // nothing was hit, but ray has exited bounds --> return 0
+            hit = RayHit(vec3(ray.gridCoords + ray.withinGridCoords), 0, 0);
+            return true;
+        }
+
+#ifdef HEATMAP
+        traversalSteps++;
+#endif
         // calculate the index of the current chunk in the top level array
-        uvec3 pos = uvec3(gridCoords) + uvec3(withinGridCoords);
+        uvec3 pos = uvec3(ray.gridCoords) + uvec3(ray.withinGridCoords);
         uint chunkIdx = getChunkIdx(pos);
 
         // read the value of the current chunk
@@ -108,7 +369,7 @@ RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
         // empty - the remaining bits are the distance field value
         // filled - the remaining bits are the uniform block ID
         // normal - the remaining bits are the index of the chunk data in the chunk data pool
-        uint chunkVal = topLevelArray[chunkIdx];
+        uint chunkVal = loadChunkValue(chunkIdx, pos);
         uint check = chunkVal >> 30u;
         chunkVal = chunkVal << 2 >> 2;
 
@@ -117,11 +378,42 @@ RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
         {
             // check if chunk is non uniformly filled
             uint blockId = chunkVal;
-            if (check == 2u)
+            uint brick = chunkVal;
+            if (check == 2u && useChunkCache)
+            {
+                brick = brickIndirection[chunkVal];
+
+                // the chunk isn't resident, it counts as uniformly filled with its LOD block
+                if (brick >> 31 != 0)
+                    blockId = brick & 0xFFu;
+            }
+
+            // mip level of the chunk data (0 = single blocks, 1 = 2x2x2, 2 = 4x4x4), based on the size of a pixel at this distance
+            uint lodLevel = 0;
+            if (useLod && check == 2u && brick >> 31 == 0 && lodFactor > 0)
+            {
+                float footprint = distance(vec3(ray.gridCoords) + ray.withinGridCoords, camPos) * lodFactor;
+                lodLevel = footprint >= 4 ? 2u : (footprint >= 2 ? 1u : 0u);
+            }
+
+            if (check == 2u && brick >> 31 == 0 && lodLevel == 1u)
+            {
+                uint cellIdx = (((pos.x & 7u) >> 1) << 4) + (((pos.z & 7u) >> 1) << 2) + ((pos.y & 7u) >> 1);
+                uint mipBase = brick * 20u;
+                blockId = 0;
+                if (((chunkMips[mipBase + 18u + (cellIdx >> 5)] >> (cellIdx & 31u)) & 1u) != 0)
+                    blockId = (chunkMips[mipBase + (cellIdx >> 2)] >> (8 * (cellIdx & 3u))) & 0xFFu;
+            }
+            else if (check == 2u && brick >> 31 == 0 && lodLevel == 2u)
+            {
+                uint cellIdx = (((pos.x & 7u) >> 2) << 2) + (((pos.z & 7u) >> 2) << 1) + ((pos.y & 7u) >> 2);
+                blockId = (chunkMips[brick * 20u + 16u + (cellIdx >> 2)] >> (8 * (cellIdx & 3u))) & 0xFFu;
+            }
+            else if (check == 2u && brick >> 31 == 0)
             {
                 // calc the index of the current block inside the chunk
                 uint withinChunkIdx = ((pos.x & 7u) << 6) + ((pos.z & 7u) << 3) + (pos.y & 7u);
-                uint poolIndex = (chunkVal << 9) + withinChunkIdx;
+                uint poolIndex = (brick << 9) + withinChunkIdx;
 
                 // check the current block in the chunk data pool
                 if (((chunkPoolBits[poolIndex >> 5] >> (31 - (withinChunkIdx & 31u))) & 1u) == 0)
@@ -142,30 +434,32 @@ RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
                 // calculate the normal / face that was hit from the last minIdx that's calculated during DDA
                 // this works because the DDA keeps track of the axis over which it last stepped
                 uint faceId = 0;
-                if (minIdx == 0)
+                if (ray.minIdx == 0)
                 {
-                    faceId = -rayPositivity.x + 2;
+                    faceId = -ray.rayPositivity.x + 2;
                 }
-                if (minIdx == 1)
+                if (ray.minIdx == 1)
                 {
-                    faceId = -rayPositivity.y + 4;
+                    faceId = -ray.rayPositivity.y + 4;
                 }
-                if (minIdx == 2)
+                if (ray.minIdx == 2)
                 {
-                    faceId = -rayPositivity.z + 6;
+                    faceId = -ray.rayPositivity.z + 6;
                 }
 
                 // return the hit
-                return RayHit(vec3(gridCoords + withinGridCoords), blockId, faceId);
+                hit = RayHit(vec3(ray.gridCoords + ray.withinGridCoords), blockId, faceId);
+                return true;
             }
             else
             {
-                // no hit, but because the current chunk is filled normally, change to single block steps
-                if (stepSize != 0)
+                // no hit, but because the current chunk is filled normally, change to single block (or mip cell) steps
+                if (ray.stepSize != lodLevel)
                 {
-                    gridCoords += ivec3(withinGridCoords);
-                    withinGridCoords = fract(withinGridCoords);
-                    stepSize = 0;
+                    ivec3 cellCoords = (ray.gridCoords + ivec3(ray.withinGridCoords)) & ~((1 << lodLevel) - 1);
+                    ray.withinGridCoords += ray.gridCoords - cellCoords;
+                    ray.gridCoords = cellCoords;
+                    ray.stepSize = lodLevel;
                 }
             }
         }
@@ -173,23 +467,30 @@ RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
         {
             // the chunk is empty --> read the distance field value and convert it to euclidean
             // subtracting by 16 after multiplying by 8, effectively subtracts by 2 in a way that doesn't cause uint overflows
-            float dfValue1 = (float((chunkVal & 0x7FFFu) << 3) - 16) * distanceFactor;
-            float dfValue2 = (float((((chunkVal >> 15) & 0x7FFFu)) << 3) - 16) * distanceFactor;
+            float dfValue1 = (float((chunkVal & 0x7FFFu) << 3) - 16) * ray.distanceFactor;
+            float dfValue2 = (float((((chunkVal >> 15) & 0x7FFFu)) << 3) - 16) * ray.distanceFactor;
 
             float dfValue = dfValue2;
-            if (rayDir.y < 0)
+            if (ray.dir.y < 0)
             {
-                float distToBottomOfChunk = (withinGridCoords.y + (gridCoords.y & 7)) * inverseDirY;
+                float distToBottomOfChunk = (ray.withinGridCoords.y + (ray.gridCoords.y & 7)) * ray.inverseDirY;
                 dfValue = max(dfValue1, min(dfValue2, distToBottomOfChunk));
             }
 
+            if (useOctantDF)
+            {
+                // subtracting 3 chunks accounts for the ray being anywhere inside the current chunk on all 3 axes
+                uint octantValue = (loadOctantWord(chunkIdx, pos, ray.octantWord) >> ray.octantShift) & 0xFFu;
+                dfValue = max(dfValue, (float(octantValue << 3) - 24) * ray.octantDistanceFactor);
+            }
+
             // if the DF value is at least 1, jump by that amount
             if (dfValue >= 1)
             {
-                rayPos = gridCoords + withinGridCoords + rayDir * dfValue;
-                gridCoords = ivec3(rayPos);
-                withinGridCoords = fract(rayPos);
-                stepSize = 0;
+                vec3 rayPos = ray.gridCoords + ray.withinGridCoords + ray.dir * dfValue;
+                ray.gridCoords = ivec3(rayPos);
+                ray.withinGridCoords = fract(rayPos);
+                ray.stepSize = 0;
 
                 // we could take an additional step here, since we safely jumped into an empty voxel (DF value -1)
                 // benchmarking showed that it's not worth it, so we terminate this step and check the new position instead
@@ -198,44 +499,130 @@ RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
 
             // ray is very close to a filled chunk
             // make the next DDA step at the 8x8x8 chunk scale
-            if (stepSize != 3)
+            if (ray.stepSize != 3)
             {
-                withinGridCoords += gridCoords & 7;
-                gridCoords -= gridCoords & 7;
-                stepSize = 3;
+                ray.withinGridCoords += ray.gridCoords & 7;
+                ray.gridCoords -= ray.gridCoords & 7;
+                ray.stepSize = 3;
             }
         }
 
         // do DDA step at appropriate scale (0 = single block, 3 = 8x8x8 chunk)
         // first we find the distance to the voxel border
-        t = ((rayPositivity << stepSize) - withinGridCoords) * rayInverse;
+        vec3 t = ((ray.rayPositivity << ray.stepSize) - ray.withinGridCoords) * ray.rayInverse;
 
         // determine the nearest axis (this is the axis on which we will cross the voxel border)
-        minIdx = t.x < t.y ? (t.x < t.z ? 0 : 2) : (t.y < t.z ? 1 : 2);
+        ray.minIdx = t.x < t.y ? (t.x < t.z ? 0 : 2) : (t.y < t.z ? 1 : 2);
 
         // increment / decrement the voxel border on the determined axis
-        gridCoords[minIdx] += int(raySign[minIdx] << stepSize);
+        ray.gridCoords[ray.minIdx] += int(ray.raySign[ray.minIdx] << ray.stepSize);
 
         // advance the ray (within grid coords) by the amount stepped
         // (this updates the other two dimensions that we didn't account for in the grid coord increment)
-        withinGridCoords += rayDir * t[minIdx];
+        ray.withinGridCoords += ray.dir * t[ray.minIdx];
 
         // set the within voxel coord of the axis on which we stepped statically
         // this sets it to either 0 or 0.999, depending on the direction of the step
         // this ensures that we don't skip a block or get stuck on a border because of floating point issues
-        withinGridCoords[minIdx] = ((1 - rayPositivity[minIdx]) << stepSize) * 0.999f;
+        ray.withinGridCoords[ray.minIdx] = ((1 - ray.rayPositivity[ray.minIdx]) << ray.stepSize) * 0.999f;
     }
 
-    // nothing was hit, but ray has exited bounds --> return 0
-    return RayHit(vec3(gridCoords + withinGridCoords), 0, 0);
+    return false;
+}
+
+RayHit intersectTerrain(vec3 rayPos, vec3 rayDir)
+{
+    RayState ray = beginRay(rayPos, rayDir);
+    RayHit hit = RayHit(vec3(0), 0, 0);
+    marchRay(ray, 0xFFFFFFFFu, hit);
+    return hit;
 }
 
+#ifdef COOPERATIVE
+// marches the rays of the whole workgroup in rounds, has to be reached by all invocations (inactive ones only help with the staging)
+// before every round, the workgroup loads the top level array entries of the chunks around its rays into shared memory once,
+// instead of every ray reading them from global memory on every step, rays outside of the staged box fall back to global memory
+RayHit intersectTerrainCooperative(vec3 rayPos, vec3 rayDir, bool active)
+{
+    RayState ray = beginRay(rayPos, rayDir);
+    RayHit hit = RayHit(vec3(0), 0, 0);
+    bool done = !active;
+
+    uvec3 chunkCount = terrainSize >> 3;
+    uint groupInvocations = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+
+    while (true)
+    {
+        if (gl_LocalInvocationIndex == 0)
+        {
+            marchingRays = 0;
+            for (uint i = 0; i < 3; i++)
+            {
+                stageLow[i] = 0xFFFFFFFFu;
+                stageHigh[i] = 0;
+                stageDirection[i] = 0;
+            }
+        }
+        barrier();
+
+        if (!done)
+        {
+            uvec3 chunk = uvec3(clamp(ray.gridCoords, ivec3(0), ivec3(terrainSize) - 1)) >> 3;
+            atomicAdd(marchingRays, 1u);
+            for (uint i = 0; i < 3; i++)
+            {
+                atomicMin(stageLow[i], chunk[i]);
+                atomicMax(stageHigh[i], chunk[i]);
+                atomicAdd(stageDirection[i], ray.raySign[i]);
+            }
+        }
+        barrier();
+
+        // all invocations read the same count, so they leave together
+        if (marchingRays == 0)
+            break;
+
+        // the box starts at the rearmost ray and extends in the direction most rays travel
+        if (gl_LocalInvocationIndex == 0)
+        {
+            uvec3 origin;
+            for (uint i = 0; i < 3; i++)
+            {
+                origin[i] = stageDirection[i] >= 0 ? stageLow[i] : max(stageHigh[i], STAGE_SIZE - 1) - (STAGE_SIZE - 1);
+                origin[i] = min(origin[i], max(chunkCount[i], STAGE_SIZE) - STAGE_SIZE);
+            }
+            stageOrigin = origin;
+        }
+        barrier();
+
+        for (uint i = gl_LocalInvocationIndex; i < STAGE_CHUNKS; i += groupInvocations)
+        {
+            uvec3 chunk = stageOrigin + uvec3(i / (STAGE_SIZE * STAGE_SIZE), (i / STAGE_SIZE) % STAGE_SIZE, i % STAGE_SIZE);
+            bool inside = all(lessThan(chunk, chunkCount));
+            uint chunkIdx = inside ? getChunkIdx(chunk << 3) : 0;
+            stagedChunks[i] = inside ? topLevelArray[chunkIdx] : 0;
+            if (useOctantDF)
+            {
+                stagedOctants[i << 1] = inside ? octantDF[chunkIdx << 1] : 0;
+                stagedOctants[(i << 1) + 1] = inside ? octantDF[(chunkIdx << 1) + 1] : 0;
+            }
+        }
+        barrier();
+
+        if (!done)
+            done = marchRay(ray, COOPERATIVE_ROUND_STEPS, hit);
+    }
+
+    return hit;
+}
+#endif
+
 vec3 getRayDir(ivec2 screenPos)
 {
     vec2 screenSpace = (screenPos + vec2(0.5)) / vec2(screenSize);
 	vec4 clipSpace = vec4(screenSpace * 2.0f - 1.0f, -1.0, 1.0);
-	vec4 eyeSpace = vec4(vec2(inverse(projMat) * clipSpace), -1.0, 0.0);
-	return normalize(vec3(inverse(viewMat) * eyeSpace));
+	vec4 eyeSpace = vec4(vec2(invProjMat * clipSpace), -1.0, 0.0);
+	return normalize(vec3(invViewMat * eyeSpace));
 }
 
 float AABBIntersect(vec3 bmin, vec3 bmax, vec3 orig, vec3 invdir)
@@ -254,14 +641,113 @@ float AABBIntersect(vec3 bmin, vec3 bmax, vec3 orig, vec3 invdir)
     return -1;
 }
 
-void main()
+#ifdef REPROJECT
+// has to match reproject.glsl
+bool wasTraced(ivec2 pixel)
+{
+    if (((uint(pixel.x + pixel.y) + prevTraceFrame) & 1u) != 0)
+        return false;
+
+    vec2 offset = (vec2(pixel) + 0.5f - vec2(screenSize) * 0.5f) / (screenSize.y * 0.5f);
+    return length(offset) <= prevPeripheryRadius || ((uint(pixel.y) ^ (prevTraceFrame >> 1)) & 1u) == 0;
+}
+
+// returns a distance along the ray that is known to be empty, 0 if there is no reliable history for this pixel
+float getReprojectedStart(ivec2 pixel, vec3 rayDir)
+{
+    // the closest reprojected hit around the pixel is only a guess, holes are simply skipped
+    uint closest = 0xFFFFFFFFu;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            closest = min(closest, imageLoad(reprojectedDepth, clamp(pixel + ivec2(x, y), ivec2(0), ivec2(screenSize) - 1)).x);
+
+    if (closest == 0xFFFFFFFFu)
+        return 0;
+
+    float start = uintBitsToFloat(closest) * REPROJECT_SAFETY - 1.0f;
+    if (start <= 0)
+        return 0;
+
+    // the guess is only used if the whole skipped segment was visible and empty in the previous frame,
+    // geometry that was hidden or outside of the view (disocclusion) fails this test and the ray starts from scratch
+    vec3 segmentBegin = camPos + rayDir * min(REPROJECT_NEAR, start);
+    vec3 segmentEnd = camPos + rayDir * start;
+    vec4 clipBegin = prevViewProjMat * vec4(segmentBegin, 1);
+    vec4 clipEnd = prevViewProjMat * vec4(segmentEnd, 1);
+    if (clipBegin.w <= 0 || clipEnd.w <= 0)
+        return 0;
+
+    // the segment projects to a line, so it stays on screen if both of its ends do
+    vec2 pixelBegin = (clipBegin.xy / clipBegin.w * 0.5f + 0.5f) * vec2(screenSize);
+    vec2 pixelEnd = (clipEnd.xy / clipEnd.w * 0.5f + 0.5f) * vec2(screenSize);
+    if (any(lessThan(min(pixelBegin, pixelEnd), vec2(0))) || any(greaterThanEqual(max(pixelBegin, pixelEnd), vec2(screenSize))))
+        return 0;
+
+    // one step per pixel, so no thin geometry of the previous frame is stepped over
+    uint steps = max(1u, uint(ceil(distance(pixelBegin, pixelEnd))));
+    if (steps > REPROJECT_MAX_STEPS)
+        return 0;
+
+    for (uint i = 0; i <= steps; i++)
+    {
+        // steps are even in screen space, 1 / w is what interpolates linearly there
+        float s = float(i) / steps;
+        float t = s / clipEnd.w / mix(1.0f / clipBegin.w, 1.0f / clipEnd.w, s);
+        vec3 point = mix(segmentBegin, segmentEnd, t);
+
+        ivec2 prevPixel = ivec2(min(mix(pixelBegin, pixelEnd, s), vec2(screenSize) - 1));
+
+        // a thin occluder that only covered a pixel that wasn't traced is missing from its guessed depth
+        if (prevCheckerboard && !wasTraced(prevPixel))
+            return 0;
+
+        float prevDepth = imageLoad(prevDepthImage, prevPixel).x;
+        if (distance(prevCamPos, point) > prevDepth - 1.0f)
+            return 0;
+    }
+
+    return start;
+}
+#endif
+
+#ifdef CHECKERBOARD
+// has to match checkerboardResolve.glsl
+bool isPeripheryTraced(ivec2 pixel)
 {
+    vec2 offset = (vec2(pixel) + 0.5f - vec2(screenSize) * 0.5f) / (screenSize.y * 0.5f);
+    return length(offset) <= peripheryRadius || ((uint(pixel.y) ^ (traceFrame >> 1)) & 1u) == 0;
+}
+#endif
+
+// traces the pixel of one invocation of the (virtual) dispatch grid
+void traceInvocation(uvec2 invocation)
+{
+#ifdef HEATMAP
+    traversalSteps = 0;
+#endif
+
+#ifdef CHECKERBOARD
+    ivec2 pixel = ivec2(invocation.x * 2 + ((invocation.y + traceFrame) & 1u), invocation.y);
+#else
+    ivec2 pixel = ivec2(invocation);
+#endif
+
     // make sure current thread is inside the window bounds
-    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, screenSize)))
+    bool active = all(lessThan(pixel, ivec2(screenSize)));
+
+#ifdef CHECKERBOARD
+    // the periphery is spatially coherent, so whole workgroups skip it together
+    active = active && isPeripheryTraced(pixel);
+#endif
+
+    // the cooperative traversal needs every invocation of the workgroup, the inactive ones return after it
+#ifndef COOPERATIVE
+    if (!active)
         return;
+#endif
 
     // calc ray direction for current pixel
-    vec3 rayDir = getRayDir(ivec2(gl_GlobalInvocationID.xy));
+    vec3 rayDir = getRayDir(pixel);
 
     vec3 rayPos = camPos;
 
@@ -275,8 +761,32 @@ void main()
         rayPos += rayDir * (intersect + 0.001);
     }
 
+    // skip the part of the ray that is known to be empty, if that gets further than the volume entry
+    float start = 0;
+#ifdef REPROJECT
+    start = max(start, getReprojectedStart(pixel, rayDir));
+#endif
+#ifdef CONE_PREPASS
+    start = max(start, imageLoad(tileStart, pixel / CONE_TILE_SIZE).x);
+#endif
+#ifdef RASTER_PREPASS
+    float boxDistance = imageLoad(rasterStart, pixel).x;
+    // the ray doesn't cross any non empty chunk
+    if (boxDistance >= RASTER_PREPASS_NO_BOX)
+        intersect = -1;
+    start = max(start, boxDistance);
+#endif
+    vec3 startPos = camPos + rayDir * start;
+    if (intersect >= 0 && start > intersect && all(greaterThanEqual(startPos, vec3(0))) && all(lessThan(startPos, vec3(terrainSize))))
+        rayPos = startPos;
+
     // intersect the ray agains the terrain if it crosses the terrain volume
     vec3 colorTime = vec3(0);
+#ifdef COOPERATIVE
+    hit = intersectTerrainCooperative(rayPos, rayDir, active && intersect >= 0);
+    if (!active)
+        return;
+#else
     if (intersect >= 0)
     {
 //        uvec2 start = clock2x32ARB();
@@ -287,7 +797,20 @@ void main()
 //        uint time = end.x - start.x;
 //        colorTime = vec3(time, 0, 0) / 1000000.0f;
     }
+#endif
+
+    // the sky is infinitely far away
+    float depth = hit.hitId != 0 ? distance(camPos, hit.hitPos) : 1e20f;
+
+#ifdef WRITE_DEPTH
+    imageStore(depthImage, pixel, vec4(depth, hit.faceId, 0, 0));
+#endif
 
+#ifdef GBUFFER
+    // shading is left to shade.glsl
+    uint chunkIdx = hit.hitId != 0 ? getChunkIdx(uvec3(hit.hitPos)) : 0xFFFFFFFFu;
+    imageStore(gBuffer, pixel, uvec4(floatBitsToUint(depth), hit.faceId, hit.hitId, chunkIdx));
+#else
     // choose color (sky or voxel color)
     vec3 color = vec3(0.69, 0.88, 0.90);
     if (hit.hitId != 0)
@@ -305,5 +828,64 @@ void main()
 
     // uncomment the following line to color pixels based on the time it took to compute them
     // color = colorTime;
-    imageStore(outImage, ivec2(gl_GlobalInvocationID.xy), vec4(color, 1));
+
+#ifdef HEATMAP
+    // blue (few steps) over green to red (256 steps or more)
+    float heat = min(traversalSteps / 256.0f, 1.0f);
+    color = heat < 0.5f ? mix(vec3(0, 0, 1), vec3(0, 1, 0), heat * 2) : mix(vec3(0, 1, 0), vec3(1, 0, 0), heat * 2 - 1);
+#endif
+    imageStore(outImage, pixel + outputOffset, vec4(color, 1));
+#endif
+}
+
+void main()
+{
+#ifdef PERSISTENT
+    // every workgroup keeps taking the next tile until all of them are taken,
+    // so the workgroups that got cheap tiles (e.g. sky) take over the rest of the screen while expensive tiles are still running
+    while (true)
+    {
+        if (gl_LocalInvocationIndex == 0)
+            currentTile = atomicAdd(nextTile, 1u);
+        barrier();
+        uint tile = currentTile;
+        barrier();
+
+        if (tile >= tileCount.x * tileCount.y)
+            return;
+
+        uvec2 tilePos = uvec2(tile % tileCount.x, tile / tileCount.x);
+        traceInvocation(tilePos * gl_WorkGroupSize.xy + gl_LocalInvocationID.xy);
+    }
+#elif defined(MULTI_VIEW)
+    // the tiles of all views are numbered consecutively, the dispatch is 2D only because of the limit on workgroups per dimension
+    uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    if (tile >= totalTiles)
+        return;
+
+    // the view with the last first tile at or before this one
+    uint low = 0;
+    uint high = viewCount - 1;
+    while (low < high)
+    {
+        uint mid = (low + high + 1) / 2;
+        if (views[mid].firstTile <= tile)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    screenSize = views[low].size;
+    camPos = views[low].camPos.xyz;
+    invViewMat = views[low].invViewMat;
+    invProjMat = views[low].invProjMat;
+    lodFactor = views[low].lodFactor;
+    outputOffset = ivec2(views[low].offset);
+
+    uint viewTile = tile - views[low].firstTile;
+    uvec2 tilePos = uvec2(viewTile % views[low].tilesX, viewTile / views[low].tilesX);
+    traceInvocation(tilePos * gl_WorkGroupSize.xy + gl_LocalInvocationID.xy);
+#else
+    traceInvocation(gl_GlobalInvocationID.xy);
+#endif
 }
@@ -0,0 +1,73 @@
+#version 460
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// scatters the hit points of the previous frame into the current view, every pixel keeps the closest one
+// initial.glsl (with REPROJECT) starts its rays just short of these distances, after checking them against the previous frame
+
+// hit distance and face ID of the previous frame
+layout(rg32f, binding = 0) uniform readonly image2D prevDepthImage;
+
+// distance to the closest reprojected hit as float bits, 0xFFFFFFFF if nothing landed on a pixel
+layout(r32ui, binding = 1) uniform coherent uimage2D reprojectedDepth;
+
+uniform uvec2 screenSize;
+
+uniform vec3 prevCamPos;
+uniform mat4 prevInvViewMat;
+uniform mat4 prevInvProjMat;
+
+uniform vec3 camPos;
+uniform mat4 viewProjMat;
+
+// with checkerboard tracing, only the pixels actually traced in the previous frame are reliable hits
+uniform bool checkerboard;
+uniform uint prevTraceFrame;
+uniform float prevPeripheryRadius;
+
+// has to match initial.glsl
+bool isTraced(ivec2 pixel)
+{
+    if (((uint(pixel.x + pixel.y) + prevTraceFrame) & 1u) != 0)
+        return false;
+
+    vec2 offset = (vec2(pixel) + 0.5f - vec2(screenSize) * 0.5f) / (screenSize.y * 0.5f);
+    return length(offset) <= prevPeripheryRadius || ((uint(pixel.y) ^ (prevTraceFrame >> 1)) & 1u) == 0;
+}
+
+vec3 getPrevRayDir(ivec2 screenPos)
+{
+    vec2 screenSpace = (screenPos + vec2(0.5)) / vec2(screenSize);
+    vec4 clipSpace = vec4(screenSpace * 2.0f - 1.0f, -1.0, 1.0);
+    vec4 eyeSpace = vec4(vec2(prevInvProjMat * clipSpace), -1.0, 0.0);
+    return normalize(vec3(prevInvViewMat * eyeSpace));
+}
+
+void main()
+{
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, screenSize)))
+        return;
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (checkerboard && !isTraced(pixel))
+        return;
+
+    float prevDepth = imageLoad(prevDepthImage, pixel).x;
+
+    // the sky has no surface to reproject
+    if (prevDepth >= 1e19f)
+        return;
+
+    vec3 hitPos = prevCamPos + getPrevRayDir(pixel) * prevDepth;
+
+    vec4 clipSpace = viewProjMat * vec4(hitPos, 1);
+    if (clipSpace.w <= 0)
+        return;
+
+    vec2 screenSpace = clipSpace.xy / clipSpace.w * 0.5f + 0.5f;
+    if (any(lessThan(screenSpace, vec2(0))) || any(greaterThanEqual(screenSpace, vec2(1))))
+        return;
+
+    // positive floats keep their order when compared as unsigned integers
+    ivec2 target = ivec2(screenSpace * vec2(screenSize));
+    imageAtomicMin(reprojectedDepth, target, floatBitsToUint(distance(camPos, hitPos)));
+}
@@ -0,0 +1,49 @@
+#version 460
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// shades the hits initial.glsl (with GBUFFER) stored, so shading features don't lengthen the traversal kernel
+
+// distance (float bits), face ID, block ID and chunk index of every pixel
+layout(rgba32ui, binding = 0) uniform readonly uimage2D gBuffer;
+
+layout(rgba8, binding = 1) uniform writeonly image2D outImage;
+
+uniform uvec2 screenSize;
+
+// distance at which the fog covers 1 - 1/e of a surface (0 = no fog)
+uniform float fogDistance;
+
+const vec3 SKY_COLOR = vec3(0.69, 0.88, 0.90);
+
+const vec3 normals[] = {
+    vec3(-1,0,0),
+    vec3(1,0,0),
+    vec3(0,-1,0),
+    vec3(0,1,0),
+    vec3(0,0,-1),
+    vec3(0,0,1)
+};
+
+void main()
+{
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, screenSize)))
+        return;
+
+    uvec4 hit = imageLoad(gBuffer, ivec2(gl_GlobalInvocationID.xy));
+    float depth = uintBitsToFloat(hit.x);
+    uint faceId = hit.y;
+    uint blockId = hit.z;
+
+    vec3 color = SKY_COLOR;
+    if (blockId != 0)
+    {
+        // same shading as initial.glsl without GBUFFER
+        color = vec3((blockId >> 5) / 7.0f, ((blockId >> 2) & 7u) / 7.0f, (blockId & 3u) / 3.0f);
+        color *= vec3(abs(dot(normals[faceId - 1], normalize(vec3(1, 3, 1.5)))));
+
+        if (fogDistance > 0)
+            color = mix(SKY_COLOR, color, exp(-depth / fogDistance));
+    }
+
+    imageStore(outImage, ivec2(gl_GlobalInvocationID.xy), vec4(color, 1));
+}
@@ -0,0 +1,63 @@
+#version 460
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// reconstructs the full resolution image from a reduced resolution trace (see RenderSettings.resolutionScale)
+// every output pixel blends its 4 closest traced pixels bilinearly, but only those on the same surface as the closest one,
+// so block edges and silhouettes stay sharp instead of bleeding into the background
+
+layout(rgba8, binding = 0) uniform readonly image2D lowColor;
+
+// hit distance and face ID of every traced pixel (written by initial.glsl with WRITE_DEPTH)
+layout(rg32f, binding = 1) uniform readonly image2D lowDepth;
+
+layout(rgba8, binding = 2) uniform writeonly image2D outImage;
+
+uniform uvec2 lowSize;
+uniform uvec2 outSize;
+
+// relative depth difference at which a sample only contributes 1/e of its bilinear weight
+const float DEPTH_SIGMA = 0.02f;
+
+void main()
+{
+    if (any(greaterThanEqual(gl_GlobalInvocationID.xy, outSize)))
+        return;
+
+    vec2 lowPos = (vec2(gl_GlobalInvocationID.xy) + 0.5f) * vec2(lowSize) / vec2(outSize) - 0.5f;
+    ivec2 base = ivec2(floor(lowPos));
+    vec2 f = lowPos - vec2(base);
+
+    ivec2 offsets[4] = {ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1)};
+    float bilinear[4] = {(1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y};
+
+    // the sample with the highest bilinear weight decides which surface this pixel belongs to
+    uint closest = 0;
+    for (uint i = 1; i < 4; i++)
+        if (bilinear[i] > bilinear[closest])
+            closest = i;
+
+    vec2 refDepth = imageLoad(lowDepth, clamp(base + offsets[closest], ivec2(0), ivec2(lowSize) - 1)).xy;
+
+    vec3 color = vec3(0);
+    float weightSum = 0;
+    for (uint i = 0; i < 4; i++)
+    {
+        ivec2 samplePos = clamp(base + offsets[i], ivec2(0), ivec2(lowSize) - 1);
+        vec2 depth = imageLoad(lowDepth, samplePos).xy;
+
+        // different faces (normals) are never blended, depths are compared relative to the distance
+        float weight = bilinear[i] * exp(-abs(depth.x - refDepth.x) / (refDepth.x * DEPTH_SIGMA));
+        if (depth.y != refDepth.y)
+            weight = 0;
+
+        color += imageLoad(lowColor, samplePos).rgb * weight;
+        weightSum += weight;
+    }
+
+    if (weightSum < 0.0001f)
+        color = imageLoad(lowColor, clamp(base + offsets[closest], ivec2(0), ivec2(lowSize) - 1)).rgb;
+    else
+        color /= weightSum;
+
+    imageStore(outImage, ivec2(gl_GlobalInvocationID.xy), vec4(color, 1));
+}
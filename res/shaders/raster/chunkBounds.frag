@@ -0,0 +1,16 @@
+#version 460
+
+// writes the distance along the ray of the pixel to the box surface, blending keeps the smallest one
+// initial.glsl (with RASTER_PREPASS) starts its rays there
+
+in vec3 worldPos;
+
+uniform vec3 camPos;
+
+layout(location = 0) out float boxDistance;
+
+void main()
+{
+    // the ray of the pixel goes through its center, just like the fragment, one block is subtracted for precision
+    boxDistance = max(distance(camPos, worldPos) - 1.0f, 0);
+}
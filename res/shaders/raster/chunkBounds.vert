@@ -0,0 +1,38 @@
+#version 460
+
+// draws one box per instance, the vertices of the box are generated from gl_VertexID (see raster_prepass.c)
+
+// position of every box in units of boxes, packed as x (11 bits), y (10 bits), z (11 bits)
+layout(std430, binding = 0) readonly buffer chunk_boxes
+{
+    uint boxes[];
+};
+
+uniform mat4 viewProjMat;
+uniform float boxSize;
+
+out vec3 worldPos;
+
+const vec3 CUBE_CORNERS[8] = {
+    vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), vec3(1, 1, 0),
+    vec3(0, 0, 1), vec3(1, 0, 1), vec3(0, 1, 1), vec3(1, 1, 1)
+};
+
+// two triangles per face, face culling is disabled, so the winding doesn't matter
+const uint CUBE_INDICES[36] = {
+    0, 1, 3, 0, 3, 2,
+    4, 6, 7, 4, 7, 5,
+    0, 2, 6, 0, 6, 4,
+    1, 5, 7, 1, 7, 3,
+    0, 4, 5, 0, 5, 1,
+    2, 3, 7, 2, 7, 6
+};
+
+void main()
+{
+    uint box = boxes[gl_InstanceID];
+    vec3 boxPos = vec3(box & 0x7FFu, (box >> 11) & 0x3FFu, box >> 21);
+
+    worldPos = (boxPos + CUBE_CORNERS[CUBE_INDICES[gl_VertexID]]) * boxSize;
+    gl_Position = viewProjMat * vec4(worldPos, 1);
+}
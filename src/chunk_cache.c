@@ -0,0 +1,491 @@
+#include <stdlib.h>
+#include <memory.h>
+#include "chunk_cache.h"
+#include "cplog.h"
+#include "glad/glad.h"
+
+#define NO_SLOT 0xFFFFFFFFu
+
+// set in the indirection table for chunks that aren't resident, the low byte holds the LOD block ID
+static const u32 NON_RESIDENT_BIT = 1u << 31;
+
+static const u32 BRICK_DATA_SIZE = 512;
+static const u32 BRICK_BITMASK_SIZE = 64;
+static const u32 BRICK_MIP_SIZE = CHUNK_MIP_WORDS * sizeof(u32);
+
+// limits the work done per frame, so streaming never causes a noticeable spike
+static const u32 MAX_UPLOADS_PER_FRAME = 1024;
+static const u32 MAX_COLUMNS_PER_FRAME = 4096;
+
+static void allocateSlots(void);
+static void freeSlots(void);
+static u32 acquireSlot(const Terrain* terrain);
+static void touchSlot(u32 slot);
+static void unlinkSlot(u32 slot);
+static void loadChunk(const Terrain* terrain, u32 poolIdx, u32 slot);
+static void setIndirection(u32 poolIdx, u32 value);
+static void flushIndirection(void);
+static u32 computeLodBlock(const u8* data);
+static void nextColumn(const Terrain* terrain, i32* dx, i32* dz);
+
+// same layout as in terrain.c, but in chunk coordinates
+static INLINE u32 getChunkIdx(u32 x, u32 y, u32 z, u32 width, u32 height)
+{
+    u32 superChunkIdx = (((x >> 1) * (width >> 4) + (z >> 1)) * (height >> 4) + (y >> 1));
+    u32 withinSuperChunkIdx = (((x & 1u) << 2) + ((z & 1u) << 1) + (y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+// ##### STATE ####
+
+static StagingRing* uploadRing;
+
+static u32 dataSSBO;
+static u32 bitmaskSSBO;
+static u32 indirectionSSBO;
+static u32 mipSSBO;
+
+static bool enabled = false;
+static bool resetPending = false;
+static u64 budget = 1024ull * 1024 * 1024;
+
+// brick slots, linked into a list from most (head) to least (tail) recently used
+static u32 slotCount = 0;
+static u32* slotOwner;
+static u32* slotPrev;
+static u32* slotNext;
+static u32* slotCycle;
+static u32 lruHead = NO_SLOT;
+static u32 lruTail = NO_SLOT;
+
+static u32* freeSlotStack;
+static u32 freeSlotCount = 0;
+static u32 residentCount = 0;
+
+// CPU copy of the indirection table, changed entries are uploaded once per frame
+static u32* indirection;
+static u32 indirectionSize = 0;
+static u32 indirectionBufferSize = 0;
+static u32 dirtyMin;
+static u32 dirtyMax;
+
+// the chunks around the camera are visited in rings of columns with increasing distance,
+// every visited chunk is stamped with the current cycle, a new cycle starts after the last ring or once the cache is full
+static u32 cycle = 0;
+static u32 columnRing = 0;
+static u32 columnRingIdx = 0;
+
+// ################
+
+void chunkCache_init(StagingRing* ring)
+{
+    uploadRing = ring;
+    glCreateBuffers(1, &dataSSBO);
+    glCreateBuffers(1, &bitmaskSSBO);
+    glCreateBuffers(1, &indirectionSSBO);
+    glCreateBuffers(1, &mipSSBO);
+}
+
+void chunkCache_destroy(void)
+{
+    freeSlots();
+    free(indirection);
+    indirection = NULL;
+    indirectionSize = 0;
+
+    glDeleteBuffers(1, &dataSSBO);
+    glDeleteBuffers(1, &bitmaskSSBO);
+    glDeleteBuffers(1, &indirectionSSBO);
+    glDeleteBuffers(1, &mipSSBO);
+}
+
+void chunkCache_setBudget(u64 bytes)
+{
+    budget = bytes;
+    resetPending = true;
+}
+
+u64 chunkCache_getBudget(void)
+{
+    return budget;
+}
+
+void chunkCache_setEnabled(bool enable)
+{
+    if (enable == enabled)
+        return;
+
+    enabled = enable;
+    resetPending = enable;
+}
+
+bool chunkCache_isEnabled(void)
+{
+    return enabled;
+}
+
+void chunkCache_reset(const Terrain* terrain)
+{
+    // the VRAM is needed for the full pools again
+    if (!enabled)
+    {
+        freeSlots();
+        return;
+    }
+
+    resetPending = false;
+    allocateSlots();
+
+    for (u32 i = 0; i < slotCount; i++)
+    {
+        slotOwner[i] = NO_SLOT;
+        freeSlotStack[i] = slotCount - 1 - i;
+    }
+    freeSlotCount = slotCount;
+    residentCount = 0;
+    lruHead = NO_SLOT;
+    lruTail = NO_SLOT;
+
+    // nothing is resident, all chunks start out as their LOD block
+    if (indirectionSize != terrain->chunkPool.maxSize)
+    {
+        free(indirection);
+        indirectionSize = terrain->chunkPool.maxSize;
+        indirection = malloc(indirectionSize * sizeof(u32));
+    }
+
+    u32 usedPoolSize = terrain->chunkPool.maxSize - terrain->chunkPool.unused;
+    for (u32 i = 0; i < indirectionSize; i++)
+        indirection[i] = NON_RESIDENT_BIT | (i < usedPoolSize ? computeLodBlock(poolAllocatorGet(&terrain->chunkPool, i)) : 0);
+
+    if (indirectionBufferSize != indirectionSize)
+    {
+        glNamedBufferData(indirectionSSBO, indirectionSize * sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+        indirectionBufferSize = indirectionSize;
+    }
+    dirtyMin = 0;
+    dirtyMax = indirectionSize;
+    flushIndirection();
+
+    cycle++;
+    columnRing = 0;
+    columnRingIdx = 0;
+
+    LOG_INFO("Chunk cache: %u of %u chunks fit into %u bricks", min(slotCount, terrain->chunkPool.size), terrain->chunkPool.size, slotCount);
+}
+
+void chunkCache_refresh(const Terrain* terrain, u32 begin, u32 end, const u8* data, const u8* bitmasks, const u32* mips)
+{
+    if (!enabled)
+        return;
+
+    // nothing to keep, the table is built from scratch
+    if (resetPending || indirectionSize == 0)
+    {
+        chunkCache_reset(terrain);
+        return;
+    }
+
+    // the new chunks start out as their LOD block like all others, the GPU copies the old entries over
+    if (indirectionSize < terrain->chunkPool.maxSize)
+    {
+        u32 newSize = terrain->chunkPool.maxSize;
+        indirection = realloc(indirection, newSize * sizeof(u32));
+        for (u32 i = indirectionSize; i < newSize; i++)
+            indirection[i] = NON_RESIDENT_BIT;
+
+        gllib_growBuffer(&indirectionSSBO, indirectionBufferSize * sizeof(u32), newSize * sizeof(u32), GL_DYNAMIC_DRAW);
+        indirectionSize = newSize;
+        indirectionBufferSize = newSize;
+    }
+
+    u32 usedPoolSize = terrain->chunkPool.maxSize - terrain->chunkPool.unused;
+    end = min(end, usedPoolSize);
+    for (u32 poolIdx = begin; poolIdx < end; poolIdx++)
+    {
+        const u8* chunkData = data ? data + (u64) (poolIdx - begin) * BRICK_DATA_SIZE : poolAllocatorGet(&terrain->chunkPool, poolIdx);
+
+        // a resident chunk keeps its slot and LRU position, only its contents are replaced
+        u32 slot = indirection[poolIdx];
+        if (slot & NON_RESIDENT_BIT)
+        {
+            setIndirection(poolIdx, NON_RESIDENT_BIT | computeLodBlock(chunkData));
+            continue;
+        }
+
+        const u8* chunkBitmask = bitmasks ? bitmasks + (u64) (poolIdx - begin) * BRICK_BITMASK_SIZE
+                                          : poolAllocatorGet(&terrain->chunkBitmaskPool, poolIdx);
+        u32 builtMips[CHUNK_MIP_WORDS];
+        if (!mips)
+            terrain_buildChunkMips(terrain, poolIdx, builtMips);
+
+        gllib_stagingUpload(uploadRing, dataSSBO, (u64) slot * BRICK_DATA_SIZE, chunkData, BRICK_DATA_SIZE);
+        gllib_stagingUpload(uploadRing, bitmaskSSBO, (u64) slot * BRICK_BITMASK_SIZE, chunkBitmask, BRICK_BITMASK_SIZE);
+        gllib_stagingUpload(uploadRing, mipSSBO, (u64) slot * BRICK_MIP_SIZE,
+                            mips ? mips + (u64) (poolIdx - begin) * CHUNK_MIP_WORDS : builtMips, BRICK_MIP_SIZE);
+    }
+
+    flushIndirection();
+}
+
+void chunkCache_update(const Terrain* terrain, vec3 camPos)
+{
+    if (!enabled)
+        return;
+
+    if (resetPending || indirectionSize != terrain->chunkPool.maxSize)
+        chunkCache_reset(terrain);
+
+    i32 maxChunkCoord = (i32) terrain->widthChunkC - 1;
+    i32 camX = max(0, min((i32) camPos.x >> 3, maxChunkCoord));
+    i32 camZ = max(0, min((i32) camPos.z >> 3, maxChunkCoord));
+
+    u32 uploads = 0;
+    for (u32 c = 0; c < MAX_COLUMNS_PER_FRAME && uploads < MAX_UPLOADS_PER_FRAME; c++)
+    {
+        i32 dx, dz;
+        nextColumn(terrain, &dx, &dz);
+
+        i32 x = camX + dx;
+        i32 z = camZ + dz;
+        if (x < 0 || z < 0 || x >= (i32) terrain->widthChunkC || z >= (i32) terrain->widthChunkC)
+            continue;
+
+        for (u32 y = 0; y < terrain->heightChunkC; y++)
+        {
+            u32 chunkVal = terrain->topLevelArray[getChunkIdx(x, y, z, terrain->width, terrain->height)];
+            if (chunkVal >> 30 != 0b10)
+                continue;
+
+            u32 poolIdx = chunkVal << 2 >> 2;
+            if ((indirection[poolIdx] & NON_RESIDENT_BIT) == 0)
+            {
+                touchSlot(indirection[poolIdx]);
+                continue;
+            }
+
+            u32 slot = acquireSlot(terrain);
+            if (slot == NO_SLOT)
+            {
+                // every resident chunk is closer than this one, start over from the camera
+                cycle++;
+                columnRing = 0;
+                columnRingIdx = 0;
+                flushIndirection();
+                return;
+            }
+
+            loadChunk(terrain, poolIdx, slot);
+            uploads++;
+        }
+    }
+
+    flushIndirection();
+}
+
+u32 chunkCache_getDataBuffer(void)
+{
+    return dataSSBO;
+}
+
+u32 chunkCache_getBitmaskBuffer(void)
+{
+    return bitmaskSSBO;
+}
+
+u32 chunkCache_getIndirectionBuffer(void)
+{
+    return indirectionSSBO;
+}
+
+u32 chunkCache_getMipBuffer(void)
+{
+    return mipSSBO;
+}
+
+u32 chunkCache_getResidentCount(void)
+{
+    return residentCount;
+}
+
+static void allocateSlots(void)
+{
+    // the tracer addresses single bytes of the data buffer with 32 bit indices
+    GLint64 maxBlockSize = 0;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+    u64 maxSlots = (maxBlockSize < (1ll << 32) ? (u64) maxBlockSize : 1ull << 32) / BRICK_DATA_SIZE;
+
+    u64 budgetSlots = budget / (BRICK_DATA_SIZE + BRICK_BITMASK_SIZE + BRICK_MIP_SIZE);
+    u32 count = (u32) (budgetSlots < maxSlots ? budgetSlots : maxSlots);
+    if (count == slotCount)
+        return;
+
+    freeSlots();
+    slotCount = count;
+
+    slotOwner = malloc(slotCount * sizeof(u32));
+    slotPrev = malloc(slotCount * sizeof(u32));
+    slotNext = malloc(slotCount * sizeof(u32));
+    slotCycle = malloc(slotCount * sizeof(u32));
+    freeSlotStack = malloc(slotCount * sizeof(u32));
+
+    glNamedBufferData(dataSSBO, (u64) slotCount * BRICK_DATA_SIZE, NULL, GL_DYNAMIC_DRAW);
+    glNamedBufferData(bitmaskSSBO, (u64) slotCount * BRICK_BITMASK_SIZE, NULL, GL_DYNAMIC_DRAW);
+    glNamedBufferData(mipSSBO, (u64) slotCount * BRICK_MIP_SIZE, NULL, GL_DYNAMIC_DRAW);
+}
+
+static void freeSlots(void)
+{
+    if (slotCount == 0)
+        return;
+
+    free(slotOwner);
+    free(slotPrev);
+    free(slotNext);
+    free(slotCycle);
+    free(freeSlotStack);
+    slotCount = 0;
+    freeSlotCount = 0;
+    residentCount = 0;
+
+    glNamedBufferData(dataSSBO, 0, NULL, GL_DYNAMIC_DRAW);
+    glNamedBufferData(bitmaskSSBO, 0, NULL, GL_DYNAMIC_DRAW);
+    glNamedBufferData(mipSSBO, 0, NULL, GL_DYNAMIC_DRAW);
+
+    // the indirection table has to be rebuilt before it's used again
+    indirectionSize = 0;
+}
+
+static u32 acquireSlot(const Terrain* terrain)
+{
+    if (freeSlotCount > 0)
+        return freeSlotStack[--freeSlotCount];
+
+    // chunks that were visited in this cycle are closer to the camera, they are never evicted
+    if (lruTail == NO_SLOT || slotCycle[lruTail] == cycle)
+        return NO_SLOT;
+
+    u32 slot = lruTail;
+    u32 poolIdx = slotOwner[slot];
+    unlinkSlot(slot);
+    setIndirection(poolIdx, NON_RESIDENT_BIT | computeLodBlock(poolAllocatorGet(&terrain->chunkPool, poolIdx)));
+    slotOwner[slot] = NO_SLOT;
+    residentCount--;
+    return slot;
+}
+
+static void touchSlot(u32 slot)
+{
+    slotCycle[slot] = cycle;
+    if (lruHead == slot)
+        return;
+
+    unlinkSlot(slot);
+
+    slotPrev[slot] = NO_SLOT;
+    slotNext[slot] = lruHead;
+    if (lruHead != NO_SLOT)
+        slotPrev[lruHead] = slot;
+    lruHead = slot;
+    if (lruTail == NO_SLOT)
+        lruTail = slot;
+}
+
+static void unlinkSlot(u32 slot)
+{
+    if (slotOwner[slot] == NO_SLOT)
+        return;
+
+    if (slotPrev[slot] != NO_SLOT)
+        slotNext[slotPrev[slot]] = slotNext[slot];
+    else
+        lruHead = slotNext[slot];
+
+    if (slotNext[slot] != NO_SLOT)
+        slotPrev[slotNext[slot]] = slotPrev[slot];
+    else
+        lruTail = slotPrev[slot];
+}
+
+static void loadChunk(const Terrain* terrain, u32 poolIdx, u32 slot)
+{
+    gllib_stagingUpload(uploadRing, dataSSBO, (u64) slot * BRICK_DATA_SIZE, poolAllocatorGet(&terrain->chunkPool, poolIdx), BRICK_DATA_SIZE);
+    gllib_stagingUpload(uploadRing, bitmaskSSBO, (u64) slot * BRICK_BITMASK_SIZE, poolAllocatorGet(&terrain->chunkBitmaskPool, poolIdx), BRICK_BITMASK_SIZE);
+
+    u32 mips[CHUNK_MIP_WORDS];
+    terrain_buildChunkMips(terrain, poolIdx, mips);
+    gllib_stagingUpload(uploadRing, mipSSBO, (u64) slot * BRICK_MIP_SIZE, mips, BRICK_MIP_SIZE);
+
+    // unowned slots aren't linked, so touching just inserts it at the head
+    touchSlot(slot);
+    slotOwner[slot] = poolIdx;
+    setIndirection(poolIdx, slot);
+    residentCount++;
+}
+
+static void setIndirection(u32 poolIdx, u32 value)
+{
+    indirection[poolIdx] = value;
+    dirtyMin = min(dirtyMin, poolIdx);
+    dirtyMax = max(dirtyMax, poolIdx + 1);
+}
+
+static void flushIndirection(void)
+{
+    if (dirtyMin >= dirtyMax)
+        return;
+
+    gllib_stagingUpload(uploadRing, indirectionSSBO, dirtyMin * sizeof(u32), indirection + dirtyMin, (dirtyMax - dirtyMin) * sizeof(u32));
+    dirtyMin = 0xFFFFFFFFu;
+    dirtyMax = 0;
+}
+
+static u32 computeLodBlock(const u8* data)
+{
+    // the highest of a few samples, so the LOD mostly shows the surface block
+    static const u32 sampleCoords[2] = {5, 2};
+    for (u32 sy = 0; sy < 2; sy++)
+        for (u32 sx = 0; sx < 2; sx++)
+            for (u32 sz = 0; sz < 2; sz++)
+            {
+                u8 block = data[sampleCoords[sx] * 64 + sampleCoords[sz] * 8 + sampleCoords[sy]];
+                if (block != 0)
+                    return block;
+            }
+
+    for (u32 i = 0; i < BRICK_DATA_SIZE; i++)
+        if (data[i] != 0)
+            return data[i];
+
+    return 0;
+}
+
+static void nextColumn(const Terrain* terrain, i32* dx, i32* dz)
+{
+    i32 r = (i32) columnRing;
+    i32 side = r == 0 ? 0 : (i32) columnRingIdx / (2 * r);
+    i32 k = r == 0 ? 0 : (i32) columnRingIdx % (2 * r);
+
+    // walk along the 4 sides of the square ring with radius r
+    switch (side)
+    {
+        case 0: *dx = -r + k; *dz = -r; break;
+        case 1: *dx = r; *dz = -r + k; break;
+        case 2: *dx = r - k; *dz = r; break;
+        default: *dx = -r; *dz = r - k; break;
+    }
+
+    columnRingIdx++;
+    if (columnRingIdx >= max(1u, 8 * columnRing))
+    {
+        columnRingIdx = 0;
+        columnRing++;
+
+        // the ring can reach the far end of the terrain from any camera position
+        if (columnRing > terrain->widthChunkC)
+        {
+            columnRing = 0;
+            cycle++;
+        }
+    }
+}
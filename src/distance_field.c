@@ -0,0 +1,769 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory.h>
+#include "distance_field.h"
+#include "workgroup_tuner.h"
+#include "cplog.h"
+#include "cptime.h"
+#include "glad/glad.h"
+#include "gllib.h"
+
+// longest line (in chunks) the shared memory of dfGenScanPass.glsl can hold
+static const u32 DF_SCAN_MAX_LINE_LENGTH = 2048;
+
+typedef enum DFShader
+{
+    DF_SHADER_PREPARE,
+    DF_SHADER_X,
+    DF_SHADER_Y,
+    DF_SHADER_Z,
+    DF_SHADER_EUCLID,
+    DF_SHADER_EUCLID_Y,
+    DF_SHADER_OCTANT,
+    DF_SHADER_SCAN,
+    DF_SHADER_COUNT
+} DFShader;
+
+static const char* const DF_SHADER_PATHS[DF_SHADER_COUNT] = {
+    "res/shaders/compute/dfGenPrepare.glsl",
+    "res/shaders/compute/dfGenXPass.glsl",
+    "res/shaders/compute/dfGenYPass.glsl",
+    "res/shaders/compute/dfGenZPass.glsl",
+    "res/shaders/compute/dfGenEuclidPass.glsl",
+    "res/shaders/compute/dfGenEuclidYPass.glsl",
+    "res/shaders/compute/dfGenOctantPass.glsl",
+    "res/shaders/compute/dfGenScanPass.glsl"
+};
+
+// prepare pass + 3 DF passes + 3 octant passes
+#define MAX_DF_PASSES 8
+
+// timer queries of sliced builds in flight
+#define SLICE_QUERY_COUNT 4
+
+// a single compute dispatch of a DF build
+// builds are split over multiple frames at workgroup granularity, lines never span workgroups
+typedef struct DFPass
+{
+    DFShader shader;
+    u32 program;
+    i32 lineAxis; // -1 if the program doesn't take a line axis
+    u32 emptyValue; // only used by the prepare pass
+    u32 linesX;
+    u32 linesY;
+    u32 groupsX;
+    u32 groupsY;
+} DFPass;
+
+// variants of a single shader compiled while its workgroup size is tuned
+typedef struct DFShaderBench
+{
+    DFShader shader;
+    u32 programs[WORKGROUP_CANDIDATE_COUNT];
+    uvec2 sizes[WORKGROUP_CANDIDATE_COUNT];
+    u32 programCount;
+} DFShaderBench;
+
+static void collectPasses(const Terrain* terrain, DistanceFieldMode dfMode, bool parallel, bool octant);
+static DFPass makePass(DFShader shader, i32 lineAxis, u32 emptyValue, u32 linesX, u32 linesY);
+static bool tuneWorkGroups(const Terrain* terrain);
+static void benchShader(uvec2 workGroupSize, void* userData);
+static u32 getBenchProgram(DFShaderBench* bench, uvec2 workGroupSize);
+static void buildShaderDefines(DFShader shader, uvec2 workGroupSize, char* defines, u32 size);
+static void dispatchPass(const DFPass* pass, u32 firstGroup, u32 groupCount);
+static void bindTargetBuffers(void);
+static void ensureBufferSize(u32 buffer, u32* currentSize, u32 size);
+static void readSliceQueries(void);
+static void finishRebuild(void);
+static bool finishShaderReload(void);
+static void updateShaderReload(void);
+static void cancelShaderReload(void);
+static float timeManhattanBuild(Terrain* terrain, bool parallel, u32 runs, u32* result);
+
+// ##### STATE ####
+
+// the top level array and octant DF are double buffered, so a sliced build never touches the buffers in use
+static u32 chunkArraySSBOs[2];
+static u32 octantSSBOs[2];
+static u32 scratchSSBO;
+
+// owned by graphics.c
+static StagingRing* uploadRing;
+
+static u32 chunkArrayBufferSizes[2];
+static u32 octantBufferSizes[2];
+static u32 scratchBufferSize = 0;
+
+// buffers used for tracing and what they contain
+static u32 front = 0;
+static bool frontValid = false;
+static DistanceFieldMode frontMode = DF_MODE_MANHATTAN;
+static bool frontOctant = false;
+
+// buffers the current build writes to and what they will contain
+static u32 target = 0;
+static DistanceFieldMode buildMode = DF_MODE_MANHATTAN;
+static bool buildOctant = false;
+
+// requested settings
+static DistanceFieldMode mode = DF_MODE_MANHATTAN;
+static bool useOctant = true;
+static bool useParallelBuild = true;
+static bool useSlices = false;
+static float sliceBudgetMs = 2.0f;
+static bool outdated = false;
+
+static uvec3 terrainSize;
+static u32 chunkCount;
+
+static DFPass passes[MAX_DF_PASSES];
+static u32 passCount = 0;
+static u32 currentPass = 0;
+static u32 currentGroup = 0;
+static bool rebuilding = false;
+
+static u32 rebuildStartTime;
+static u32 rebuildFrames;
+
+// measured GPU time per workgroup of each pass (0 = not measured yet)
+static float groupTimeNs[MAX_DF_PASSES];
+
+static u32 sliceQueries[SLICE_QUERY_COUNT];
+static u32 sliceQueryPass[SLICE_QUERY_COUNT];
+static u32 sliceQueryGroups[SLICE_QUERY_COUNT];
+static bool sliceQueryPending[SLICE_QUERY_COUNT];
+static u32 nextSliceQuery = 0;
+
+static bool shadersLoaded = false;
+
+static u32 shaderDFGenPrepare;
+static u32 shaderDFGenX;
+static u32 shaderDFGenY;
+static u32 shaderDFGenZ;
+static u32 shaderDFGenEuclid;
+static u32 shaderDFGenEuclidY;
+static u32 shaderDFGenOctant;
+static u32 shaderDFGenScan;
+
+static u32* const shaderSlots[DF_SHADER_COUNT] = {
+    &shaderDFGenPrepare,
+    &shaderDFGenX,
+    &shaderDFGenY,
+    &shaderDFGenZ,
+    &shaderDFGenEuclid,
+    &shaderDFGenEuclidY,
+    &shaderDFGenOctant,
+    &shaderDFGenScan
+};
+
+// workgroup size the program in each slot was compiled with (the scan pass uses one fixed size workgroup per line)
+static uvec2 shaderWorkGroupSizes[DF_SHADER_COUNT] = {{8, 8}, {8, 8}, {8, 8}, {8, 8}, {8, 8}, {8, 8}, {8, 8}, {1, 1}};
+
+// terrain width and height each shader was tuned for
+static uvec2 tunedTerrainSizes[DF_SHADER_COUNT];
+
+// a reload compiles into these and only replaces the shaders in use once all of them are done
+static u32 pendingShaders[DF_SHADER_COUNT];
+static bool shaderReloadPending = false;
+
+// ################
+
+void distanceField_init(StagingRing* ring)
+{
+    uploadRing = ring;
+    glCreateBuffers(2, chunkArraySSBOs);
+    glCreateBuffers(2, octantSSBOs);
+    glCreateBuffers(1, &scratchSSBO);
+    glCreateQueries(GL_TIME_ELAPSED, SLICE_QUERY_COUNT, sliceQueries);
+}
+
+void distanceField_destroy(void)
+{
+    glDeleteBuffers(2, chunkArraySSBOs);
+    glDeleteBuffers(2, octantSSBOs);
+    glDeleteBuffers(1, &scratchSSBO);
+    glDeleteQueries(SLICE_QUERY_COUNT, sliceQueries);
+    cancelShaderReload();
+}
+
+void distanceField_loadShaders(void)
+{
+    // all shaders are started before the first one is checked, so the driver can compile them in parallel
+    distanceField_reloadShaders();
+    if (!finishShaderReload())
+        exit(-1);
+}
+
+void distanceField_reloadShaders(void)
+{
+    cancelShaderReload();
+
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+    {
+        char defines[128];
+        buildShaderDefines(i, shaderWorkGroupSizes[i], defines, sizeof(defines));
+        pendingShaders[i] = gllib_startComputeVariant(DF_SHADER_PATHS[i], defines);
+    }
+    shaderReloadPending = true;
+}
+
+void distanceField_freeShaders(void)
+{
+    if (!shadersLoaded)
+        return;
+
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+        glDeleteProgram(*shaderSlots[i]);
+
+    shadersLoaded = false;
+}
+
+void distanceField_rebuild(Terrain* terrain, bool allowSliced)
+{
+    // the first DF has to be built right away, there is nothing to trace with in the meantime
+    bool sliced = useSlices && frontValid && allowSliced;
+    target = sliced ? front ^ 1 : front;
+
+    // the settings may change while a sliced build runs, the buffers are labelled with the ones they were built with
+    buildMode = mode;
+    buildOctant = useOctant;
+
+    terrainSize = (uvec3) {terrain->width, terrain->height, terrain->width};
+    chunkCount = terrain->chunkCount;
+
+    // the DF is written into the top level array, so it always starts from the plain chunk values
+    ensureBufferSize(chunkArraySSBOs[target], &chunkArrayBufferSizes[target], chunkCount * sizeof(u32));
+    gllib_stagingUpload(uploadRing, chunkArraySSBOs[target], 0, terrain->topLevelArray, chunkCount * sizeof(u32));
+
+    if (buildMode == DF_MODE_EUCLIDEAN)
+    {
+        // scratch memory for the lower envelope of each line
+        ensureBufferSize(scratchSSBO, &scratchBufferSize, chunkCount * sizeof(u32));
+    }
+
+    if (buildOctant)
+    {
+        // 8 bytes per chunk
+        ensureBufferSize(octantSSBOs[target], &octantBufferSizes[target], chunkCount * 2 * sizeof(u32));
+    }
+
+    bool parallel = useParallelBuild && max(terrain->width, terrain->height) / 8 <= DF_SCAN_MAX_LINE_LENGTH;
+    collectPasses(terrain, buildMode, parallel, buildOctant);
+
+    // passes that weren't tuned for this world size yet are benchmarked on the uploaded data, which is then uploaded again
+    if (tuneWorkGroups(terrain))
+    {
+        collectPasses(terrain, buildMode, parallel, buildOctant);
+        gllib_stagingUpload(uploadRing, chunkArraySSBOs[target], 0, terrain->topLevelArray, chunkCount * sizeof(u32));
+    }
+
+    currentPass = 0;
+    currentGroup = 0;
+    rebuilding = true;
+    outdated = false;
+    rebuildStartTime = uclock();
+    rebuildFrames = 0;
+
+    if (sliced)
+        return;
+
+    glFinish();
+    u32 start = uclock();
+
+    for (u32 i = 0; i < passCount; i++)
+        dispatchPass(&passes[i], 0, passes[i].groupsX * passes[i].groupsY);
+
+    glFinish();
+    u32 finish = uclock();
+    LOG_INFO("Building %s%s DF for %u x %u x %u nodes took: %.02fms", buildMode == DF_MODE_EUCLIDEAN ? "euclidean" : "manhattan",
+             buildOctant ? " + octant" : "", terrain->width / 8, terrain->height / 8, terrain->width / 8, (finish - start) / 1000.0f);
+
+    finishRebuild();
+}
+
+bool distanceField_update(void)
+{
+    updateShaderReload();
+
+    if (!rebuilding)
+        return false;
+
+    readSliceQueries();
+
+    // fill the time budget of this frame based on the previous slices of the current pass
+    // a slice never spans two passes, so its timing can be attributed to a single pass
+    const DFPass* pass = &passes[currentPass];
+    u32 remainingGroups = pass->groupsX * pass->groupsY - currentGroup;
+    u32 groupCount = 1;
+    if (groupTimeNs[currentPass] > 0)
+        groupCount = max(1, (u32) (sliceBudgetMs * 1000000.0f / groupTimeNs[currentPass]));
+    groupCount = min(groupCount, remainingGroups);
+
+    u32 query = nextSliceQuery;
+    nextSliceQuery = (nextSliceQuery + 1) % SLICE_QUERY_COUNT;
+
+    glBeginQuery(GL_TIME_ELAPSED, sliceQueries[query]);
+    dispatchPass(pass, currentGroup, groupCount);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    sliceQueryPass[query] = currentPass;
+    sliceQueryGroups[query] = groupCount;
+    sliceQueryPending[query] = true;
+
+    rebuildFrames++;
+    currentGroup += groupCount;
+    if (currentGroup == pass->groupsX * pass->groupsY)
+    {
+        currentPass++;
+        currentGroup = 0;
+    }
+
+    if (currentPass == passCount)
+    {
+        LOG_INFO("Sliced %s%s DF build finished after %u frames (%.02fms)", buildMode == DF_MODE_EUCLIDEAN ? "euclidean" : "manhattan",
+                 buildOctant ? " + octant" : "", rebuildFrames, (uclock() - rebuildStartTime) / 1000.0f);
+        finishRebuild();
+        return true;
+    }
+
+    return false;
+}
+
+bool distanceField_isRebuilding(void)
+{
+    return rebuilding;
+}
+
+bool distanceField_isOutdated(void)
+{
+    return outdated;
+}
+
+u32 distanceField_getChunkArrayBuffer(void)
+{
+    return chunkArraySSBOs[front];
+}
+
+u32 distanceField_getOctantBuffer(void)
+{
+    return octantSSBOs[front];
+}
+
+DistanceFieldMode distanceField_getActiveMode(void)
+{
+    return frontMode;
+}
+
+bool distanceField_getActiveOctant(void)
+{
+    return frontOctant;
+}
+
+void distanceField_setMode(DistanceFieldMode dfMode)
+{
+    if (dfMode == mode)
+        return;
+
+    mode = dfMode;
+    outdated = true;
+}
+
+DistanceFieldMode distanceField_getMode(void)
+{
+    return mode;
+}
+
+void distanceField_setOctant(bool enabled)
+{
+    if (enabled == useOctant)
+        return;
+
+    useOctant = enabled;
+    outdated = true;
+}
+
+bool distanceField_getOctant(void)
+{
+    return useOctant;
+}
+
+void distanceField_setParallelBuild(bool enabled)
+{
+    if (enabled == useParallelBuild)
+        return;
+
+    useParallelBuild = enabled;
+    outdated = true;
+}
+
+bool distanceField_getParallelBuild(void)
+{
+    return useParallelBuild;
+}
+
+void distanceField_setSliced(bool enabled, float budgetMs)
+{
+    useSlices = enabled;
+    sliceBudgetMs = budgetMs;
+}
+
+bool distanceField_getSliced(void)
+{
+    return useSlices;
+}
+
+void distanceField_benchmark(Terrain* terrain, u32 runs)
+{
+    // the benchmark overwrites the buffers used for tracing
+    rebuilding = false;
+    frontValid = false;
+    target = front;
+
+    terrainSize = (uvec3) {terrain->width, terrain->height, terrain->width};
+    chunkCount = terrain->chunkCount;
+    ensureBufferSize(chunkArraySSBOs[target], &chunkArrayBufferSizes[target], chunkCount * sizeof(u32));
+
+    u32* sweepResult = malloc(chunkCount * sizeof(u32));
+    u32* scanResult = malloc(chunkCount * sizeof(u32));
+
+    float sweepTime = timeManhattanBuild(terrain, false, runs, sweepResult);
+    float scanTime = timeManhattanBuild(terrain, true, runs, scanResult);
+    bool identical = memcmp(sweepResult, scanResult, chunkCount * sizeof(u32)) == 0;
+
+    LOG_INFO("DF benchmark %u x %u x %u nodes: sweep %.02fms, scan %.02fms (%.02fx), results %s",
+             terrain->width / 8, terrain->height / 8, terrain->width / 8, sweepTime, scanTime, sweepTime / scanTime,
+             identical ? "identical" : "DIFFER");
+
+    free(sweepResult);
+    free(scanResult);
+
+    outdated = true;
+}
+
+// returns the average GPU time of the prepare + manhattan passes in ms and reads back the result of the last run
+static float timeManhattanBuild(Terrain* terrain, bool parallel, u32 runs, u32* result)
+{
+    u32 query;
+    glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+    collectPasses(terrain, DF_MODE_MANHATTAN, parallel, false);
+
+    u64 totalNs = 0;
+    for (u32 i = 0; i < runs; i++)
+    {
+        glNamedBufferSubData(chunkArraySSBOs[target], 0, chunkCount * sizeof(u32), terrain->topLevelArray);
+
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (u32 p = 0; p < passCount; p++)
+            dispatchPass(&passes[p], 0, passes[p].groupsX * passes[p].groupsY);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        totalNs += ns;
+    }
+
+    glGetNamedBufferSubData(chunkArraySSBOs[target], 0, chunkCount * sizeof(u32), result);
+    glDeleteQueries(1, &query);
+
+    return totalNs / (float) runs / 1000000.0f;
+}
+
+static void collectPasses(const Terrain* terrain, DistanceFieldMode dfMode, bool parallel, bool octant)
+{
+    DFPass newPasses[MAX_DF_PASSES];
+    u32 count = 0;
+
+    u32 width = terrain->width;
+    u32 height = terrain->height;
+
+    // prepare pass (set all empty chunk DF values to highest)
+    // the euclidean DF works on squared distances, its max value is still far beyond the largest supported terrain
+    newPasses[count++] = makePass(DF_SHADER_PREPARE, -1, dfMode == DF_MODE_EUCLIDEAN ? 0x3FFFFF : 0xFFF, width / 8, width / 8);
+
+    if (dfMode == DF_MODE_EUCLIDEAN)
+    {
+        // Z and X Pass - exact 1D transforms along Z and X
+        newPasses[count++] = makePass(DF_SHADER_EUCLID, 2, 0, width / 8, height / 8);
+        newPasses[count++] = makePass(DF_SHADER_EUCLID, 0, 0, height / 8, width / 8);
+
+        // Y Pass - exact 1D transform along Y, converts the squared distances and packs both DF values
+        newPasses[count++] = makePass(DF_SHADER_EUCLID_Y, -1, 0, width / 8, width / 8);
+    }
+    else if (parallel)
+    {
+        // one workgroup per line instead of one invocation per line
+        newPasses[count++] = makePass(DF_SHADER_SCAN, 2, 0, width / 8, height / 8);
+        newPasses[count++] = makePass(DF_SHADER_SCAN, 0, 0, height / 8, width / 8);
+        newPasses[count++] = makePass(DF_SHADER_SCAN, 1, 0, width / 8, width / 8);
+    }
+    else
+    {
+        // Z, X and Y Pass - each spreads in 2 sweeps along the axis, Y runs last and packs both DF values
+        newPasses[count++] = makePass(DF_SHADER_Z, -1, 0, width / 8, height / 8);
+        newPasses[count++] = makePass(DF_SHADER_X, -1, 0, height / 8, width / 8);
+        newPasses[count++] = makePass(DF_SHADER_Y, -1, 0, width / 8, width / 8);
+    }
+
+    if (octant)
+    {
+        // only reads the chunk flags of the top level array, so it doesn't matter that the DF is already written
+        // the Z Pass seeds the field, the X and Y Pass spread it further
+        newPasses[count++] = makePass(DF_SHADER_OCTANT, 2, 0, width / 8, height / 8);
+        newPasses[count++] = makePass(DF_SHADER_OCTANT, 0, 0, height / 8, width / 8);
+        newPasses[count++] = makePass(DF_SHADER_OCTANT, 1, 0, width / 8, width / 8);
+    }
+
+    // timings measured for a different set of passes are meaningless
+    if (count != passCount || memcmp(newPasses, passes, count * sizeof(DFPass)) != 0)
+        memset(groupTimeNs, 0, sizeof(groupTimeNs));
+
+    memcpy(passes, newPasses, count * sizeof(DFPass));
+    passCount = count;
+}
+
+static DFPass makePass(DFShader shader, i32 lineAxis, u32 emptyValue, u32 linesX, u32 linesY)
+{
+    uvec2 size = shaderWorkGroupSizes[shader];
+    return (DFPass) {shader, *shaderSlots[shader], lineAxis, emptyValue, linesX, linesY,
+                     (linesX + size.x - 1) / size.x, (linesY + size.y - 1) / size.y};
+}
+
+static bool tuneWorkGroups(const Terrain* terrain)
+{
+    // the sizes of a pending reload would be outdated, tuning waits for the next rebuild
+    if (shaderReloadPending)
+        return false;
+
+    bool changed = false;
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+    {
+        // the scan pass is laid out for 256 invocations per line
+        if (i == DF_SHADER_SCAN || (tunedTerrainSizes[i].x == terrain->width && tunedTerrainSizes[i].y == terrain->height))
+            continue;
+
+        bool used = false;
+        for (u32 p = 0; p < passCount; p++)
+            used |= passes[p].shader == i;
+        if (!used)
+            continue;
+
+        char key[96];
+        snprintf(key, sizeof(key), "%s %ux%u", strrchr(DF_SHADER_PATHS[i], '/') + 1, terrain->width, terrain->height);
+
+        DFShaderBench bench = {.shader = i};
+        uvec2 size = workGroupTuner_get(key, benchShader, &bench);
+        tunedTerrainSizes[i] = (uvec2) {terrain->width, terrain->height};
+
+        if (size.x != shaderWorkGroupSizes[i].x || size.y != shaderWorkGroupSizes[i].y)
+        {
+            // the winner was already compiled while benchmarking, unless it came from the cache file
+            u32 program = getBenchProgram(&bench, size);
+            bench.programCount--;
+            for (u32 b = 0; b < bench.programCount; b++)
+                if (bench.programs[b] == program)
+                    bench.programs[b] = bench.programs[bench.programCount];
+
+            glDeleteProgram(*shaderSlots[i]);
+            *shaderSlots[i] = program;
+            shaderWorkGroupSizes[i] = size;
+            changed = true;
+        }
+
+        for (u32 b = 0; b < bench.programCount; b++)
+            glDeleteProgram(bench.programs[b]);
+    }
+
+    return changed;
+}
+
+static void benchShader(uvec2 workGroupSize, void* userData)
+{
+    DFShaderBench* bench = userData;
+    u32 program = getBenchProgram(bench, workGroupSize);
+
+    for (u32 i = 0; i < passCount; i++)
+    {
+        if (passes[i].shader != bench->shader)
+            continue;
+
+        DFPass pass = passes[i];
+        pass.program = program;
+        pass.groupsX = (pass.linesX + workGroupSize.x - 1) / workGroupSize.x;
+        pass.groupsY = (pass.linesY + workGroupSize.y - 1) / workGroupSize.y;
+        dispatchPass(&pass, 0, pass.groupsX * pass.groupsY);
+    }
+}
+
+static u32 getBenchProgram(DFShaderBench* bench, uvec2 workGroupSize)
+{
+    for (u32 i = 0; i < bench->programCount; i++)
+        if (bench->sizes[i].x == workGroupSize.x && bench->sizes[i].y == workGroupSize.y)
+            return bench->programs[i];
+
+    char defines[128];
+    buildShaderDefines(bench->shader, workGroupSize, defines, sizeof(defines));
+
+    u32 idx = bench->programCount++;
+    bench->programs[idx] = gllib_makeComputeVariant(DF_SHADER_PATHS[bench->shader], defines);
+    bench->sizes[idx] = workGroupSize;
+    return bench->programs[idx];
+}
+
+static void buildShaderDefines(DFShader shader, uvec2 workGroupSize, char* defines, u32 size)
+{
+    if (shader == DF_SHADER_SCAN)
+        defines[0] = '\0';
+    else
+        snprintf(defines, size, "#define LOCAL_SIZE_X %u\n#define LOCAL_SIZE_Y %u\n", workGroupSize.x, workGroupSize.y);
+}
+
+static void dispatchPass(const DFPass* pass, u32 firstGroup, u32 groupCount)
+{
+    bindTargetBuffers();
+
+    glUseProgram(pass->program);
+    glUniform3ui(0, terrainSize.x, terrainSize.y, terrainSize.z);
+    if (pass->shader == DF_SHADER_PREPARE)
+        glUniform1ui(1, pass->emptyValue);
+    if (pass->lineAxis >= 0)
+        glUniform1ui(2, pass->lineAxis);
+    if (pass->shader != DF_SHADER_SCAN)
+        glUniform2ui(4, pass->linesX, pass->linesY);
+
+    // the workgroups are numbered row by row, a range of them is covered by (at most) a partial row,
+    // a block of full rows and another partial row
+    u32 endGroup = firstGroup + groupCount;
+    while (firstGroup < endGroup)
+    {
+        u32 x = firstGroup % pass->groupsX;
+        u32 y = firstGroup / pass->groupsX;
+        glUniform2ui(3, x, y);
+
+        if (x == 0 && endGroup - firstGroup >= pass->groupsX)
+        {
+            u32 rows = (endGroup - firstGroup) / pass->groupsX;
+            glDispatchCompute(pass->groupsX, rows, 1);
+            firstGroup += rows * pass->groupsX;
+        }
+        else
+        {
+            u32 count = min(pass->groupsX - x, endGroup - firstGroup);
+            glDispatchCompute(count, 1, 1);
+            firstGroup += count;
+        }
+    }
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+static void bindTargetBuffers(void)
+{
+    // the tracer uses the same binding points, so they are set again for every dispatch
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, chunkArraySSBOs[target]);
+    if (scratchBufferSize != 0)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, scratchSSBO);
+    if (octantBufferSizes[target] != 0)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, octantSSBOs[target]);
+}
+
+static void ensureBufferSize(u32 buffer, u32* currentSize, u32 size)
+{
+    if (*currentSize == size)
+        return;
+
+    glNamedBufferData(buffer, size, NULL, GL_DYNAMIC_COPY);
+    *currentSize = size;
+}
+
+static void readSliceQueries(void)
+{
+    for (u32 i = 0; i < SLICE_QUERY_COUNT; i++)
+    {
+        if (!sliceQueryPending[i])
+            continue;
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(sliceQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(sliceQueries[i], GL_QUERY_RESULT, &ns);
+        sliceQueryPending[i] = false;
+
+        float measured = ns / (float) sliceQueryGroups[i];
+        float* estimate = &groupTimeNs[sliceQueryPass[i]];
+        *estimate = *estimate == 0 ? measured : (*estimate + measured) * 0.5f;
+    }
+}
+
+static void finishRebuild(void)
+{
+    // the next trace dispatch is issued after all DF dispatches, so swapping on the CPU is enough
+    front = target;
+    frontValid = true;
+    frontMode = buildMode;
+    frontOctant = buildOctant;
+    rebuilding = false;
+}
+
+static bool finishShaderReload(void)
+{
+    shaderReloadPending = false;
+
+    bool success = true;
+    bool finished[DF_SHADER_COUNT];
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+    {
+        finished[i] = gllib_finishProgram(pendingShaders[i]);
+        success &= finished[i];
+    }
+
+    if (!success)
+    {
+        for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+            if (finished[i])
+                glDeleteProgram(pendingShaders[i]);
+        return false;
+    }
+
+    distanceField_freeShaders();
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+        *shaderSlots[i] = pendingShaders[i];
+
+    // a running build refers to the old programs, start over
+    if (rebuilding)
+    {
+        rebuilding = false;
+        outdated = true;
+    }
+
+    shadersLoaded = true;
+    return true;
+}
+
+static void updateShaderReload(void)
+{
+    if (!shaderReloadPending)
+        return;
+
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+        if (!gllib_isProgramReady(pendingShaders[i]))
+            return;
+
+    if (!finishShaderReload())
+        LOG_ERROR("Reloading the distance field shaders failed, the previous ones stay in use");
+}
+
+static void cancelShaderReload(void)
+{
+    if (!shaderReloadPending)
+        return;
+
+    shaderReloadPending = false;
+    for (u32 i = 0; i < DF_SHADER_COUNT; i++)
+        if (gllib_finishProgram(pendingShaders[i]))
+            glDeleteProgram(pendingShaders[i]);
+}
@@ -0,0 +1,256 @@
+// popen and pclose are POSIX, -std=c17 doesn't declare them otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "frame_recorder.h"
+#include "cplog.h"
+#include "glad/glad.h"
+
+// frames that can be in flight between the GPU and the writer, capturing only waits if all of them are
+#define RECORDER_SLOTS 4
+
+#ifdef _WIN32
+#define openPipe(command) _popen(command, "wb")
+#define closePipe _pclose
+#else
+#define openPipe(command) popen(command, "w")
+#define closePipe pclose
+#endif
+
+typedef enum SlotState
+{
+    SLOT_FREE,
+    // the GPU is still copying the frame into the slot
+    SLOT_READING,
+    // the writer owns the slot until it wrote the frame
+    SLOT_WRITING
+} SlotState;
+
+static void publishReadFrames(bool waitForAll);
+static void* writeFrames(void* userData);
+
+// ##### STATE ####
+
+static bool recording = false;
+static FILE* output;
+static bool outputIsPipe;
+
+static uvec2 frameSize;
+static u64 frameBytes;
+
+// one persistently mapped buffer with a frame per slot
+static u32 pixelBuffer;
+static u8* mappedFrames;
+static GLsync fences[RECORDER_SLOTS];
+
+// the next slot a frame is read into, and the oldest one the GPU may still be reading into
+static u32 nextCapture;
+static u32 nextPublish;
+static u32 waitCount;
+
+// shared with the writer thread, guarded by the mutex
+static pthread_t writerThread;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slotChanged = PTHREAD_COND_INITIALIZER;
+static SlotState slotStates[RECORDER_SLOTS];
+static bool stopping;
+static bool writeFailed;
+static u32 framesWritten;
+
+// ################
+
+bool frameRecorder_start(const char* path, uvec2 size)
+{
+    if (recording)
+        frameRecorder_stop();
+
+    outputIsPipe = path[0] == '|';
+    output = outputIsPipe ? openPipe(path + 1) : fopen(path, "wb");
+    if (output == NULL)
+    {
+        LOG_ERROR("Could not open %s for recording: %s", path, strerror(errno));
+        return false;
+    }
+
+#ifndef _WIN32
+    // a consumer that exits early fails the writes instead of terminating the renderer
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    frameSize = size;
+    frameBytes = (u64) size.x * size.y * 4;
+
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &pixelBuffer);
+    glNamedBufferStorage(pixelBuffer, frameBytes * RECORDER_SLOTS, NULL, flags);
+    mappedFrames = glMapNamedBufferRange(pixelBuffer, 0, frameBytes * RECORDER_SLOTS, flags);
+
+    memset(fences, 0, sizeof(fences));
+    memset(slotStates, 0, sizeof(slotStates));
+    nextCapture = 0;
+    nextPublish = 0;
+    waitCount = 0;
+    stopping = false;
+    writeFailed = false;
+    framesWritten = 0;
+
+    if (pthread_create(&writerThread, NULL, writeFrames, NULL) != 0)
+        PANIC("Could not start the frame writer thread");
+
+    recording = true;
+    LOG_INFO("Recording %ux%u frames to %s", size.x, size.y, path);
+    return true;
+}
+
+void frameRecorder_captureFrame(uvec2 size)
+{
+    if (!recording)
+        return;
+
+    if (size.x != frameSize.x || size.y != frameSize.y)
+    {
+        LOG_WARNING("The window size changed to %ux%u, stopping the recording", size.x, size.y);
+        frameRecorder_stop();
+        return;
+    }
+
+    publishReadFrames(false);
+
+    // only happens if the writer fell a whole ring behind, the frame is never dropped
+    pthread_mutex_lock(&mutex);
+    bool full = slotStates[nextCapture] != SLOT_FREE;
+    pthread_mutex_unlock(&mutex);
+    if (full)
+    {
+        waitCount++;
+        publishReadFrames(true);
+
+        pthread_mutex_lock(&mutex);
+        while (slotStates[nextCapture] != SLOT_FREE)
+            pthread_cond_wait(&slotChanged, &mutex);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // with a pixel pack buffer bound, reading only queues a copy on the GPU
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    glReadPixels(0, 0, (GLsizei) frameSize.x, (GLsizei) frameSize.y, GL_RGBA, GL_UNSIGNED_BYTE, (void*) (nextCapture * frameBytes));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[nextCapture] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    pthread_mutex_lock(&mutex);
+    slotStates[nextCapture] = SLOT_READING;
+    pthread_mutex_unlock(&mutex);
+
+    nextCapture = (nextCapture + 1) % RECORDER_SLOTS;
+}
+
+void frameRecorder_stop(void)
+{
+    if (!recording)
+        return;
+
+    // the writer finishes all published frames before it exits
+    publishReadFrames(true);
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&slotChanged);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(writerThread, NULL);
+
+    bool closed = (outputIsPipe ? closePipe(output) : fclose(output)) == 0;
+    glUnmapNamedBuffer(pixelBuffer);
+    glDeleteBuffers(1, &pixelBuffer);
+    recording = false;
+
+    if (writeFailed || !closed)
+    {
+        LOG_ERROR("Could not write all recorded frames, %u were written", framesWritten);
+    }
+    else
+    {
+        LOG_INFO("Recorded %u frames, capturing waited %u times for the writer", framesWritten, waitCount);
+    }
+}
+
+bool frameRecorder_isRecording(void)
+{
+    return recording;
+}
+
+// hands the frames the GPU finished copying to the writer, in the order they were captured
+static void publishReadFrames(bool waitForAll)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&mutex);
+        bool reading = slotStates[nextPublish] == SLOT_READING;
+        pthread_mutex_unlock(&mutex);
+        if (!reading)
+            return;
+
+        if (waitForAll)
+        {
+            while (glClientWaitSync(fences[nextPublish], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        }
+        else
+        {
+            GLenum status = glClientWaitSync(fences[nextPublish], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+        }
+
+        glDeleteSync(fences[nextPublish]);
+        fences[nextPublish] = NULL;
+
+        pthread_mutex_lock(&mutex);
+        slotStates[nextPublish] = SLOT_WRITING;
+        pthread_cond_broadcast(&slotChanged);
+        pthread_mutex_unlock(&mutex);
+
+        nextPublish = (nextPublish + 1) % RECORDER_SLOTS;
+    }
+}
+
+static void* writeFrames(void* userData)
+{
+    (void) userData;
+    u32 slot = 0;
+
+    pthread_mutex_lock(&mutex);
+    while (true)
+    {
+        while (slotStates[slot] != SLOT_WRITING && !stopping)
+            pthread_cond_wait(&slotChanged, &mutex);
+
+        // frames are published in order, so nothing is left once the next one isn't
+        if (slotStates[slot] != SLOT_WRITING)
+            break;
+
+        bool skip = writeFailed;
+        pthread_mutex_unlock(&mutex);
+
+        // GL images start with the bottom row
+        bool written = !skip;
+        u64 rowBytes = (u64) frameSize.x * 4;
+        const u8* frame = mappedFrames + slot * frameBytes;
+        for (u32 y = 0; y < frameSize.y && written; y++)
+            written = fwrite(frame + (frameSize.y - 1 - y) * rowBytes, 1, rowBytes, output) == rowBytes;
+
+        pthread_mutex_lock(&mutex);
+        writeFailed |= !written;
+        framesWritten += written;
+        slotStates[slot] = SLOT_FREE;
+        pthread_cond_broadcast(&slotChanged);
+
+        slot = (slot + 1) % RECORDER_SLOTS;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return NULL;
+}
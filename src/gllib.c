@@ -1,5 +1,11 @@
 #include <glad/glad.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <memory.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 #include "gllib.h"
 #include "cplog.h"
 #define STB_INCLUDE_IMPLEMENTATION
@@ -7,7 +13,92 @@
 #include "stb_include.h"
 #include "cpmath.h"
 
+// GL_KHR_parallel_shader_compile (and the identical ARB extension), not part of the glad loader
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// GL_NV_shader_thread_group, not part of the glad loader either
+#define GL_WARP_SIZE_NV 0x9339
+#define GL_WARPS_PER_SM_NV 0x933A
+#define GL_SM_COUNT_NV 0x933B
+
+#define SHADER_CACHE_DIR "shadercache"
+#define MAX_PENDING_PROGRAMS 64
+
+// a program whose compilation was started, but not checked yet
+typedef struct PendingProgram
+{
+    u32 program;
+    u32 shader;
+    u64 hash;
+} PendingProgram;
+
+static char* loadShaderSource(const char* path);
+static char* insertDefines(char* code, const char* defines);
 static u32 makeShader(const char* path, GLenum shaderType);
+static void advanceStagingSegment(StagingRing* ring);
+static u64 hashShaderSource(const char* code);
+static bool loadProgramBinary(u32 program, u64 hash);
+static void saveProgramBinary(u32 program, u64 hash);
+static i32 findPendingProgram(u32 program);
+
+// ##### STATE ####
+
+static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+static bool parallelCompileSupported = false;
+
+// thread limits of the GPU, 0 if the driver doesn't report them
+static u32 smCount = 0;
+static u32 warpsPerSm = 0;
+static u32 warpSize = 0;
+
+static PendingProgram pendingPrograms[MAX_PENDING_PROGRAMS];
+static u32 pendingProgramCount = 0;
+
+// ################
+
+void gllib_init(GllibLoadProc loadProc)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (i32 i = 0; i < extensionCount; i++)
+    {
+        const char* extension = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        if (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+            glMaxShaderCompilerThreadsKHR = loadProc("glMaxShaderCompilerThreadsKHR");
+        else if (strcmp(extension, "GL_ARB_parallel_shader_compile") == 0 && glMaxShaderCompilerThreadsKHR == NULL)
+            glMaxShaderCompilerThreadsKHR = loadProc("glMaxShaderCompilerThreadsARB");
+        else if (strcmp(extension, "GL_NV_shader_thread_group") == 0)
+        {
+            GLint value = 0;
+            glGetIntegerv(GL_SM_COUNT_NV, &value);
+            smCount = value;
+            glGetIntegerv(GL_WARPS_PER_SM_NV, &value);
+            warpsPerSm = value;
+            glGetIntegerv(GL_WARP_SIZE_NV, &value);
+            warpSize = value;
+            LOG_INFO("GPU runs up to %u warps of %u threads on each of its %u SMs", warpsPerSm, warpSize, smCount);
+        }
+    }
+
+    parallelCompileSupported = glMaxShaderCompilerThreadsKHR != NULL;
+    if (parallelCompileSupported)
+    {
+        // let the driver decide how many threads it uses
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+        LOG_INFO("Parallel shader compilation is supported");
+    }
+}
+
+u32 gllib_getResidentWorkGroups(u32 groupInvocations)
+{
+    if (smCount == 0 || warpsPerSm == 0 || warpSize == 0)
+        return 0;
+
+    u32 warpsPerGroup = (groupInvocations + warpSize - 1) / warpSize;
+    return smCount * max(1u, warpsPerSm / warpsPerGroup);
+}
 
 u32 gllib_makePipeline(const char *vertPath, const char *fragPath)
 {
@@ -40,28 +131,103 @@ u32 gllib_makePipeline(const char *vertPath, const char *fragPath)
 
 u32 gllib_makeCompute(const char *shaderPath)
 {
-    u32 shader = makeShader(shaderPath, GL_COMPUTE_SHADER);
+    return gllib_makeComputeVariant(shaderPath, NULL);
+}
+
+u32 gllib_startCompute(const char* shaderPath)
+{
+    return gllib_startComputeVariant(shaderPath, NULL);
+}
+
+u32 gllib_makeComputeVariant(const char* shaderPath, const char* defines)
+{
+    u32 shaderProgram = gllib_startComputeVariant(shaderPath, defines);
+    if (!gllib_finishProgram(shaderProgram))
+        exit(-1);
+
+    return shaderProgram;
+}
+
+u32 gllib_startComputeVariant(const char* shaderPath, const char* defines)
+{
+    char* code = insertDefines(loadShaderSource(shaderPath), defines);
+    u64 hash = hashShaderSource(code);
 
     u32 shaderProgram = glCreateProgram();
+    if (loadProgramBinary(shaderProgram, hash))
+    {
+        free(code);
+        return shaderProgram;
+    }
+
+    if (pendingProgramCount == MAX_PENDING_PROGRAMS)
+        PANIC("Too many shader programs are being compiled at once");
+
+    u32 shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, (const GLchar* const*) &code, NULL);
+    glCompileShader(shader);
+    free(code);
+
+    // the status isn't queried here, so the driver can keep compiling in the background
     glAttachShader(shaderProgram, shader);
+    glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(shaderProgram);
 
+    pendingPrograms[pendingProgramCount++] = (PendingProgram) {shaderProgram, shader, hash};
+    return shaderProgram;
+}
+
+bool gllib_isProgramReady(u32 program)
+{
+    if (!parallelCompileSupported || findPendingProgram(program) < 0)
+        return true;
+
+    GLint completed = GL_FALSE;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed == GL_TRUE;
+}
+
+bool gllib_finishProgram(u32 program)
+{
+    // programs from the binary cache are done right away
+    i32 idx = findPendingProgram(program);
+    if (idx < 0)
+        return true;
+
+    PendingProgram pending = pendingPrograms[idx];
+    pendingPrograms[idx] = pendingPrograms[--pendingProgramCount];
+
     GLint isLinked = 0;
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &isLinked);
+    glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
     if (isLinked == GL_FALSE)
     {
+        // the compile log is more helpful, if there is one
+        GLint isCompiled = 0;
+        glGetShaderiv(pending.shader, GL_COMPILE_STATUS, &isCompiled);
+
         GLint maxLength = 0;
-        glGetProgramiv(shaderProgram, GL_INFO_LOG_LENGTH, &maxLength);
-        char errorLog[maxLength];
-        glGetProgramInfoLog(shaderProgram, maxLength, &maxLength, errorLog);
+        if (isCompiled == GL_FALSE)
+            glGetShaderiv(pending.shader, GL_INFO_LOG_LENGTH, &maxLength);
+        else
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
+
+        char errorLog[max(maxLength, 1)];
+        errorLog[0] = '\0';
+        if (isCompiled == GL_FALSE)
+            glGetShaderInfoLog(pending.shader, maxLength, &maxLength, errorLog);
+        else
+            glGetProgramInfoLog(program, maxLength, &maxLength, errorLog);
+
         LOG_ERROR("ERROR COMPILING SHADER: %s", errorLog);
-        glDeleteProgram(shaderProgram);
-        exit(-1);
+        glDeleteShader(pending.shader);
+        glDeleteProgram(program);
+        return false;
     }
 
-    glDeleteShader(shader);
-
-    return shaderProgram;
+    glDetachShader(program, pending.shader);
+    glDeleteShader(pending.shader);
+    saveProgramBinary(program, pending.hash);
+    return true;
 }
 
 Texture gllib_makeDefaultTexture(u32 width, u32 height, u32 glInternalFormat, u32 glFilter)
@@ -90,7 +256,85 @@ void gllib_bindTexture(const Texture *texture, u32 idx, u32 glUsage)
     glBindImageTexture(idx, texture->handle, 0, GL_FALSE, 0, glUsage, texture->internalFormat);
 }
 
-static u32 makeShader(const char* path, GLenum shaderType)
+void gllib_growBuffer(u32* buffer, u64 oldSize, u64 newSize, u32 glUsage)
+{
+    u32 newBuffer;
+    glCreateBuffers(1, &newBuffer);
+    glNamedBufferData(newBuffer, newSize, NULL, glUsage);
+    glCopyNamedBufferSubData(*buffer, newBuffer, 0, 0, oldSize < newSize ? oldSize : newSize);
+    glDeleteBuffers(1, buffer);
+    *buffer = newBuffer;
+}
+
+StagingRing gllib_makeStagingRing(u32 size)
+{
+    StagingRing ring;
+    ring.segmentSize = size / STAGING_RING_SEGMENTS;
+    ring.size = ring.segmentSize * STAGING_RING_SEGMENTS;
+    ring.head = 0;
+    memset(ring.fences, 0, sizeof(ring.fences));
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &ring.buffer);
+    glNamedBufferStorage(ring.buffer, ring.size, NULL, flags);
+    ring.memory = glMapNamedBufferRange(ring.buffer, 0, ring.size, flags);
+    return ring;
+}
+
+void gllib_destroyStagingRing(StagingRing* ring)
+{
+    for (u32 i = 0; i < STAGING_RING_SEGMENTS; i++)
+        if (ring->fences[i] != NULL)
+            glDeleteSync(ring->fences[i]);
+
+    glUnmapNamedBuffer(ring->buffer);
+    glDeleteBuffers(1, &ring->buffer);
+}
+
+void gllib_stagingUpload(StagingRing* ring, u32 dstBuffer, u64 dstOffset, const void* data, u64 size)
+{
+    const u8* src = data;
+    while (size > 0)
+    {
+        // never let a single copy cross a segment border
+        u32 segmentEnd = (ring->head / ring->segmentSize + 1) * ring->segmentSize;
+        u32 count = segmentEnd - ring->head;
+        if (size < count)
+            count = (u32)size;
+
+        memcpy(ring->memory + ring->head, src, count);
+        glCopyNamedBufferSubData(ring->buffer, dstBuffer, ring->head, dstOffset, count);
+
+        // keep copies 4 byte aligned
+        ring->head += (count + 3) & ~3u;
+        src += count;
+        dstOffset += count;
+        size -= count;
+
+        if (ring->head >= segmentEnd)
+            advanceStagingSegment(ring);
+    }
+}
+
+// fences the segment that was just filled and waits until the GPU is done with the next one
+static void advanceStagingSegment(StagingRing* ring)
+{
+    u32 segment = (ring->head - 1) / ring->segmentSize;
+    ring->fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    u32 next = (segment + 1) % STAGING_RING_SEGMENTS;
+    ring->head = next * ring->segmentSize;
+
+    if (ring->fences[next] != NULL)
+    {
+        // only blocks if the whole ring was filled faster than the GPU could copy out of it
+        while (glClientWaitSync(ring->fences[next], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(ring->fences[next]);
+        ring->fences[next] = NULL;
+    }
+}
+
+static char* loadShaderSource(const char* path)
 {
     char error[256];
     char* code = stb_include_file((char*) path, (char*) "", (char*) "res/shaders/inc", error);
@@ -99,6 +343,41 @@ static u32 makeShader(const char* path, GLenum shaderType)
         LOG_ERROR("Error Parsing Shader: %s", error);
         exit(-1);
     }
+    return code;
+}
+
+static char* insertDefines(char* code, const char* defines)
+{
+    if (defines == NULL || defines[0] == '\0')
+        return code;
+
+    // the #version directive has to stay the first line
+    char* versionEnd = strstr(code, "#version");
+    versionEnd = versionEnd == NULL ? code : strchr(versionEnd, '\n');
+    if (versionEnd == NULL)
+        versionEnd = code + strlen(code);
+    else if (*versionEnd == '\n')
+        versionEnd++;
+
+    // keeps the line numbers of compile errors matching the file
+    const char* lineReset = "#line 2\n";
+
+    size_t headerLength = versionEnd - code;
+    size_t definesLength = strlen(defines);
+    size_t lineResetLength = strlen(lineReset);
+    char* out = malloc(strlen(code) + definesLength + lineResetLength + 1);
+    memcpy(out, code, headerLength);
+    memcpy(out + headerLength, defines, definesLength);
+    memcpy(out + headerLength + definesLength, lineReset, lineResetLength);
+    strcpy(out + headerLength + definesLength + lineResetLength, versionEnd);
+
+    free(code);
+    return out;
+}
+
+static u32 makeShader(const char* path, GLenum shaderType)
+{
+    char* code = loadShaderSource(path);
 
     u32 shader = glCreateShader(shaderType);
     glShaderSource(shader, 1, (const GLchar* const*) &code, NULL);
@@ -120,3 +399,106 @@ static u32 makeShader(const char* path, GLenum shaderType)
     free(code);
     return shader;
 }
+
+static u64 hashShaderSource(const char* code)
+{
+    // FNV-1a over the preprocessed source and the driver, a driver update invalidates all binaries
+    const char* parts[] = {
+        code,
+        (const char*) glGetString(GL_VENDOR),
+        (const char*) glGetString(GL_RENDERER),
+        (const char*) glGetString(GL_VERSION)
+    };
+
+    u64 hash = 14695981039346656037ull;
+    for (u32 i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        for (const char* c = parts[i]; *c != '\0'; c++)
+        {
+            hash ^= (u8) *c;
+            hash *= 1099511628211ull;
+        }
+
+        // separator, so moving characters between parts changes the hash
+        hash ^= 0xFF;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool loadProgramBinary(u32 program, u64 hash)
+{
+    char path[64];
+    snprintf(path, sizeof(path), SHADER_CACHE_DIR "/%016llx.bin", (unsigned long long) hash);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    u32 header[2];
+    void* binary = NULL;
+    bool success = fread(header, sizeof(header), 1, file) == 1;
+    if (success)
+    {
+        binary = malloc(header[1]);
+        success = fread(binary, 1, header[1], file) == header[1];
+    }
+    fclose(file);
+
+    if (success)
+    {
+        glProgramBinary(program, header[0], binary, header[1]);
+
+        // the driver may still reject the binary, the program is compiled from source then
+        GLint isLinked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+        success = isLinked == GL_TRUE;
+    }
+
+    free(binary);
+    return success;
+}
+
+static void saveProgramBinary(u32 program, u64 hash)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    u32 header[2];
+    void* binary = malloc(length);
+    glGetProgramBinary(program, length, NULL, &header[0], binary);
+    header[1] = length;
+
+#ifdef _WIN32
+    _mkdir(SHADER_CACHE_DIR);
+#else
+    mkdir(SHADER_CACHE_DIR, 0755);
+#endif
+
+    char path[64];
+    snprintf(path, sizeof(path), SHADER_CACHE_DIR "/%016llx.bin", (unsigned long long) hash);
+
+    FILE* file = fopen(path, "wb");
+    if (file != NULL)
+    {
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(binary, 1, length, file);
+        fclose(file);
+    }
+    else
+    {
+        LOG_WARNING("Could not write the shader cache file %s", path);
+    }
+
+    free(binary);
+}
+
+static i32 findPendingProgram(u32 program)
+{
+    for (u32 i = 0; i < pendingProgramCount; i++)
+        if (pendingPrograms[i].program == program)
+            return (i32) i;
+    return -1;
+}
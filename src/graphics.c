@@ -1,15 +1,93 @@
 #include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "graphics.h"
 #include "cpmath.h"
 #include "cplog.h"
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 #include "gllib.h"
-#include "cptime.h"
+#include "distance_field.h"
+#include "chunk_cache.h"
+#include "workgroup_tuner.h"
+#include "raster_prepass.h"
+#include "frame_recorder.h"
 
 static const int DEFAULT_WINDOW_WIDTH = 1280;
 static const int DEFAULT_WINDOW_HEIGHT = 720;
 
+static const float FIELD_OF_VIEW = 70.0f;
+
+// chunk mips are computed and uploaded in batches of this many chunks
+#define MIP_UPLOAD_BATCH 4096
+
+// initial.glsl is compiled once per combination of its compile time settings (terrain size, features, workgroup size)
+#define MAX_SHADER_VARIANTS 16
+#define MAX_VARIANT_DEFINES 512
+
+// timer queries of the tracing pass in flight, results are read a few frames later to avoid stalls
+#define STATS_QUERY_COUNT 4
+
+// screen space passes that don't need any variants
+#define FIXED_SHADER_COUNT 5
+
+static const char* const FIXED_SHADER_PATHS[FIXED_SHADER_COUNT] = {
+    "res/shaders/compute/upsample.glsl",
+    "res/shaders/compute/reproject.glsl",
+    "res/shaders/compute/conePrepass.glsl",
+    "res/shaders/compute/checkerboardResolve.glsl",
+    "res/shaders/compute/shade.glsl"
+};
+
+// pixels per side of the tiles of the cone prepass (has to match the shaders)
+#define CONE_TILE_SIZE 8
+
+// views are packed into rows of an atlas that is at least this wide
+#define MIN_ATLAS_WIDTH 2048
+
+// workgroups started by the persistent tracing pass if the GPU doesn't report its limits, enough to fill current GPUs
+#define DEFAULT_PERSISTENT_GROUP_COUNT 1024
+
+typedef struct ShaderVariant
+{
+    char defines[MAX_VARIANT_DEFINES];
+    u32 program;
+} ShaderVariant;
+
+// per frame inputs of the tracing pass
+typedef struct TraceParams
+{
+    const Terrain* terrain;
+    vec3 camPos;
+    mat4 invViewMat;
+    mat4 invProjMat;
+    float lodFactor;
+    bool writeDepth;
+    bool reproject;
+    bool conePrepass;
+    bool rasterPrepass;
+    bool checkerboard;
+    bool gBuffer;
+    bool cooperative;
+    bool persistent;
+    bool multiView;
+} TraceParams;
+
+// camera of one view of graphics_drawViews, has to match View in initial.glsl (std430)
+typedef struct GPUView
+{
+    mat4 invViewMat;
+    mat4 invProjMat;
+    vec4 camPos;
+    uvec2 offset;
+    uvec2 size;
+    u32 firstTile;
+    u32 tilesX;
+    float lodFactor;
+    u32 padding;
+} GPUView;
+
 static void createWindowAndContext(void);
 static void freeWindowAndContext(void);
 
@@ -22,8 +100,38 @@ static void freePermanentResources(void);
 static void createWorldResources(void);
 static void freeWorldResources(void);
 
+// uploads changes of the terrain, (re)builds the distance field and streams the chunk cache around the camera
+static void updateTerrain(Terrain* terrain, vec3 camPos);
+static void applyRenderSettings(const RenderSettings* settings);
+static bool isUpsampling(void);
+static bool isWritingDepth(void);
+static void upsample(void);
+static void reprojectHistory(vec3 camPos, mat4 viewProjMat);
+static void traceTileCones(const TraceParams* params);
+static void resolveCheckerboard(vec3 camPos, mat4 invViewMat, mat4 invProjMat, mat4 viewProjMat);
+static float getPeripheryRadius(void);
+static void shadeGBuffer(void);
+static void collectTraceStats(void);
+
 static void loadShaders(void);
 static void freeShaders(void);
+static void updateShaderReload(void);
+static void buildTerrainDefines(const TraceParams* params, uvec2 groupSize, char* defines);
+static void bindTraceBuffers(void);
+static void traceTerrain(const TraceParams* params, uvec2 groupSize, char* defines);
+static u32 getPersistentGroupCount(uvec2 groupSize);
+static void benchTrace(uvec2 groupSize, void* userData);
+static float timeTrace(const TraceParams* params, u32 runs);
+static u32 getTerrainVariant(const char* defines);
+static void freeTerrainVariants(void);
+
+static mat4 inverseViewMatrix(vec3 camPos, vec3 forward);
+static mat4 inversePerspectiveMatrix(float fov, float aspectRatio, float zNear, float zFar);
+static mat4 cropInverseProjection(mat4 invProjMat, uvec2 offset, uvec2 size, uvec2 fullSize);
+
+static void uploadChunkMips(const Terrain* terrain, u32 begin, u32 end);
+static void snapshotPoolChanges(const Terrain* terrain);
+static void applyPoolChanges(const Terrain* terrain);
 
 // callback for opengl
 static void APIENTRY glDebugOutput(GLenum source,
@@ -42,27 +150,176 @@ static GLFWwindow* window;
 static u32 resX;
 static u32 resY;
 
+// resolution that is actually traced (window resolution times the resolution scale)
+static u32 traceResX;
+static u32 traceResY;
+
 static bool renderingResourcesCreated = false;
 static bool shadersLoaded = false;
 
-static u32 terrainChunkArraySSBO;
 static u32 terrainPoolSSBO;
 static u32 terrainBitPoolSSBO;
+static u32 terrainMipPoolSSBO;
 
 static u32 currentPoolBufferSize = 0;
 
-static u32 fbComputeTarget;
+// all terrain uploads go through this ring, so they never stall on buffers the GPU still reads from
+static const u32 UPLOAD_RING_SIZE = 32 * 1024 * 1024;
+static StagingRing uploadRing;
+
+// whether the chunk cache was used for the pools that are currently on the GPU
+static bool poolsCached = false;
+
+// chunks that changed for the DF build in progress, copied if the build is sliced (see snapshotPoolChanges)
+static u32 pendingPoolBegin = 0xFFFFFFFFu;
+static u32 pendingPoolEnd = 0;
+static u8* pendingPoolData;
+static u8* pendingBitmaskData;
+static u32* pendingMipData;
 
-static u32 shaderTerrainInitial;
-static u32 shaderDFGenPrepare;
-static u32 shaderDFGenX;
-static u32 shaderDFGenY;
-static u32 shaderDFGenZ;
+// settings of the last frame, only changes are forwarded to the other modules
+static RenderSettings appliedSettings;
+static bool settingsApplied = false;
+
+static float resolutionScale = 1.0f;
+
+static u32 fbComputeTarget;
+// next tile of the persistent tracing pass
+static u32 rayQueueSSBO;
+
+// cameras and atlas of graphics_drawViews, the atlas only ever grows
+static u32 viewSSBO;
+static Texture texAtlas;
+static u32 atlasWidth = 0;
+static u32 atlasHeight = 0;
+static u32 fbUpsampleTarget;
+
+static ShaderVariant terrainVariants[MAX_SHADER_VARIANTS];
+static u32 terrainVariantCount = 0;
+static u32 nextVariantEviction = 0;
+static char currentTerrainDefines[MAX_VARIANT_DEFINES];
+
+// workgroup size of the tracing pass, either set explicitly or tuned per world size
+static uvec2 workGroupSize = {8, 8};
+static bool autoWorkGroupSize = true;
+static uvec2 tunedTerrainSize = {0, 0};
+
+static u32 shaderUpsample;
+static u32 shaderReproject;
+static u32 shaderConePrepass;
+static u32 shaderCheckerboardResolve;
+static u32 shaderShade;
+
+static u32* const fixedShaderSlots[FIXED_SHADER_COUNT] = {
+    &shaderUpsample,
+    &shaderReproject,
+    &shaderConePrepass,
+    &shaderCheckerboardResolve,
+    &shaderShade
+};
+
+// shader reloads compile in the background, the current shaders are used until they are done
+static u32 pendingTerrainInitial;
+static char pendingTerrainDefines[MAX_VARIANT_DEFINES];
+static bool shaderReloadPending = false;
+static u32 pendingFixedShaders[FIXED_SHADER_COUNT];
+static bool fixedReloadPending = false;
 
 static Texture texTerrainInitial;
+// hit distance and face ID of every traced pixel, only written while upsampling or reprojecting
+static Texture texTerrainDepth;
+static Texture texPrevTerrainDepth;
+// closest hit of the previous frame that landed on each pixel (float bits)
+static Texture texReprojectedDepth;
+// empty distance along the rays of each tile, written by the cone prepass
+static Texture texTileStart;
+// distance to the closest chunk bounds of every pixel, written by the raster prepass
+static Texture texRasterStart;
+// hit of every traced pixel for deferred shading (distance, face ID, block ID, chunk index)
+static Texture texGBuffer;
+
+// camera of the previous frame, if its depth is still valid (the terrain and resolution didn't change)
+static bool historyValid = false;
+static vec3 prevCamPos;
+static mat4 prevInvViewMat;
+static mat4 prevInvProjMat;
+static mat4 prevViewProjMat;
+
+// checkerboard tracing alternates between the two pixel colors (and the periphery between the rows) with this counter
+static u32 traceFrame = 0;
+static bool prevCheckerboard = false;
+static u32 prevTraceFrame;
+static float prevPeripheryRadius;
+// resolved color of the previous frame, only kept while tracing a checkerboard
+static Texture texPrevColor;
+static bool colorHistoryValid = false;
+// window resolution result of the upsampling pass
+static Texture texUpsampled;
+
+static u32 traceQueries[STATS_QUERY_COUNT];
+static bool traceQueryPending[STATS_QUERY_COUNT];
+static u32 nextTraceQuery = 0;
+static double statsStartTime = 0;
+static double statsTraceMs = 0;
+static u32 statsFrameCount = 0;
 
 // ################
 
+RenderSettings graphics_defaultRenderSettings(void)
+{
+    return (RenderSettings) {
+            .resolutionScale = 1.0f,
+            .upsample = true,
+            .dfMode = DF_MODE_MANHATTAN,
+            .octantDF = false,
+            .parallelDFBuild = false,
+            .slicedDFBuild = false,
+            .slicedDFBudgetMs = 2.0f,
+            .chunkCache = false,
+            .lodBias = 1.0f,
+            .reprojection = true,
+            .conePrepass = true,
+            .rasterPrepass = false,
+            .checkerboard = false,
+            .peripheryRadius = 0.0f,
+            .deferredShading = false,
+            .fogDistance = 0.0f,
+            .cooperativeTraversal = false,
+            .persistentThreads = false,
+            .persistentGroupCount = 0,
+            .workGroupSize = {0, 0},
+            .stats = false,
+            .heatmap = false
+    };
+}
+
+void graphics_logRenderSettings(const RenderSettings* settings)
+{
+    char workGroup[32] = "auto";
+    if (settings->workGroupSize.x != 0 || settings->workGroupSize.y != 0)
+        snprintf(workGroup, sizeof(workGroup), "%ux%u", settings->workGroupSize.x, settings->workGroupSize.y);
+
+    LOG_INFO("Render settings: scale %.2f%s, DF %s%s%s%s, chunk cache %s, LOD bias %.1f, workgroup %s%s%s%s%s%s%s%s%s%s",
+             settings->resolutionScale,
+             settings->resolutionScale < 1 && settings->upsample ? " (upsampled)" : "",
+             settings->dfMode == DF_MODE_EUCLIDEAN ? "euclidean" : "manhattan",
+             settings->octantDF ? " + octant" : "",
+             settings->parallelDFBuild ? ", parallel build" : "",
+             settings->slicedDFBuild ? ", sliced build" : "",
+             settings->chunkCache ? "on" : "off",
+             settings->lodBias,
+             workGroup,
+             settings->reprojection ? ", reprojection" : "",
+             settings->conePrepass ? ", cone prepass" : "",
+             settings->rasterPrepass ? ", raster prepass" : "",
+             settings->checkerboard ? (settings->peripheryRadius > 0 ? ", checkerboard + periphery" : ", checkerboard") : "",
+             settings->deferredShading ? (settings->fogDistance > 0 ? ", deferred shading + fog" : ", deferred shading") : "",
+             settings->cooperativeTraversal ? ", cooperative traversal" : "",
+             settings->persistentThreads ? ", persistent threads" : "",
+             settings->stats ? ", stats" : "",
+             settings->heatmap ? ", heatmap" : "");
+}
+
 void graphics_init(void)
 {
     createWindowAndContext();
@@ -81,109 +338,300 @@ void graphics_destroy(void)
     freeWindowAndContext();
 }
 
-void graphics_drawFrame(Terrain *terrain, vec3 camPos, vec3 forward)
+void graphics_drawFrame(Terrain *terrain, vec3 camPos, vec3 forward, const RenderSettings* settings)
 {
-    mat4 viewMat = worldToCamMatrix(camPos,
-                              forward,
-                              (vec3) {0, 1, 0});
+    applyRenderSettings(settings);
+
+    // the tracer only needs the inverse matrices, so they are built directly
+    mat4 invViewMat = inverseViewMatrix(camPos, forward);
+    mat4 invProjMat = inversePerspectiveMatrix(radians(FIELD_OF_VIEW), traceResX / (float) traceResY, 0.01, 1000);
+
+    // projects the hits of the previous frame into this one
+    const vec3 globalUp = {0, 1, 0};
+    mat4 viewProjMat = matMul(perspectiveProjectionMatrix(radians(FIELD_OF_VIEW), traceResX / (float) traceResY, 0.01, 1000),
+                              worldToCamMatrix(camPos, forward, globalUp));
 
-    mat4 projMat = perspectiveProjectionMatrix(radians(70.0f), resX / (float) resY, 0.01, 1000);
+    updateTerrain(terrain, camPos);
 
-    if (terrain->dirty)
+    bool reproject = appliedSettings.reprojection && historyValid;
+    if (reproject)
+        reprojectHistory(camPos, viewProjMat);
+
+    // the boxes are drawn with their own buffer bindings, so this has to happen before the trace buffers are bound
+    bool rasterPrepass = appliedSettings.rasterPrepass
+                         && rasterPrepass_draw(terrain, &texRasterStart, traceResX, traceResY, camPos, viewProjMat);
+    glViewport(0, 0, resX, resY);
+
+    // render terrain (initial ray tracing)
+    bindTraceBuffers();
+
+    // size of a pixel at distance 1, scaled by the LOD setting
+    float pixelSize = 2.0f * tanf(radians(FIELD_OF_VIEW) * 0.5f) / traceResY;
+    TraceParams params = {
+            .terrain = terrain,
+            .camPos = camPos,
+            .invViewMat = invViewMat,
+            .invProjMat = invProjMat,
+            .lodFactor = pixelSize * appliedSettings.lodBias,
+            .writeDepth = isWritingDepth(),
+            .reproject = reproject,
+            .conePrepass = appliedSettings.conePrepass,
+            .rasterPrepass = rasterPrepass,
+            .checkerboard = appliedSettings.checkerboard,
+            .gBuffer = appliedSettings.deferredShading && !appliedSettings.heatmap,
+            .cooperative = appliedSettings.cooperativeTraversal,
+            .persistent = appliedSettings.persistentThreads
+    };
+
+    if (params.conePrepass)
+        traceTileCones(&params);
+
+    // the tracer is tuned once the world is completely on the GPU, so the timings are representative
+    if (autoWorkGroupSize && (tunedTerrainSize.x != terrain->width || tunedTerrainSize.y != terrain->height)
+        && !terrain->dirty && !distanceField_isRebuilding())
     {
-        // TODO: keep track of dirty chunks instead of flushing the entire buffer
-        // update / create top level chunk array SSBOs
-        if (currentPoolBufferSize == 0)
-        {
-            glNamedBufferData(terrainChunkArraySSBO, terrain->chunkCount * sizeof(u32), terrain->topLevelArray, GL_STATIC_DRAW);
-        }
-        else
-        {
-            glNamedBufferSubData(terrainChunkArraySSBO, 0, terrain->chunkCount * sizeof(u32), terrain->topLevelArray);
-        }
+        char key[64];
+        snprintf(key, sizeof(key), "initial.glsl %ux%u", terrain->width, terrain->height);
+        workGroupSize = workGroupTuner_get(key, benchTrace, &params);
+        tunedTerrainSize = (uvec2) {terrain->width, terrain->height};
+    }
 
-        // update / create pool SSBOs
-        if (terrain->chunkPool.maxSize != currentPoolBufferSize)
-        {
-            glNamedBufferData(terrainPoolSSBO, terrain->chunkPool.maxSize * terrain->chunkPool.unitSize, terrain->chunkPool.memory, GL_STATIC_DRAW);
-            glNamedBufferData(terrainBitPoolSSBO, terrain->chunkBitmaskPool.maxSize * terrain->chunkBitmaskPool.unitSize, terrain->chunkBitmaskPool.memory, GL_STATIC_DRAW);
-        }
-        else
-        {
-            glNamedBufferSubData(terrainPoolSSBO, 0, terrain->chunkPool.maxSize * terrain->chunkPool.unitSize, terrain->chunkPool.memory);
-            glNamedBufferSubData(terrainBitPoolSSBO, 0, terrain->chunkBitmaskPool.maxSize * terrain->chunkBitmaskPool.unitSize, terrain->chunkBitmaskPool.memory);
-        }
-        terrain->dirty = false;
+    u32 query = nextTraceQuery;
+    if (appliedSettings.stats && !traceQueryPending[query])
+        glBeginQuery(GL_TIME_ELAPSED, traceQueries[query]);
+
+    traceTerrain(&params, workGroupSize, currentTerrainDefines);
 
-        glFinish();
-        u32 start = uclock();
-        // generate distance field
-        // prepare pass (set all empty chunk DF values to highest)
-        glUseProgram(shaderDFGenPrepare);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainChunkArraySSBO);
-        glUniform3ui(0, terrain->width, terrain->height, terrain->width);
-        glDispatchCompute(terrain->width / 64, terrain->width / 64, 1);
+    if (appliedSettings.stats && !traceQueryPending[query])
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        traceQueryPending[query] = true;
+        nextTraceQuery = (nextTraceQuery + 1) % STATS_QUERY_COUNT;
+    }
+    collectTraceStats();
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    // the resolve reads the shaded colors of the traced pixels
+    if (params.gBuffer)
+        shadeGBuffer();
 
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (params.checkerboard)
+    {
+        resolveCheckerboard(camPos, invViewMat, invProjMat, viewProjMat);
+        glCopyImageSubData(texTerrainInitial.handle, GL_TEXTURE_2D, 0, 0, 0, 0,
+                           texPrevColor.handle, GL_TEXTURE_2D, 0, 0, 0, 0, traceResX, traceResY, 1);
+    }
 
-        // Z Pass - spread in 2 passes along Z and -Z
-        glUseProgram(shaderDFGenZ);
-        glUniform3ui(0, terrain->width, terrain->height, terrain->width);
-        glDispatchCompute(terrain->width / 64, terrain->height / 64, 1);
+    // blit compute output to screen (scaled, if the resolution scale isn't 1 and the image wasn't upsampled)
+    if (isUpsampling())
+    {
+        upsample();
+        glBlitNamedFramebuffer(fbUpsampleTarget, 0,
+                               0, 0, resX, resY,
+                               0, 0, resX, resY,
+                               GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    else
+    {
+        glBlitNamedFramebuffer(fbComputeTarget, 0,
+                               0, 0, traceResX, traceResY,
+                               0, 0, resX, resY,
+                               GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
 
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    // the depth of this frame becomes the history of the next one
+    historyValid = isWritingDepth();
+    if (historyValid)
+    {
+        Texture swap = texPrevTerrainDepth;
+        texPrevTerrainDepth = texTerrainDepth;
+        texTerrainDepth = swap;
+
+        prevCamPos = camPos;
+        prevInvViewMat = invViewMat;
+        prevInvProjMat = invProjMat;
+        prevViewProjMat = viewProjMat;
+        prevCheckerboard = params.checkerboard;
+        prevTraceFrame = traceFrame;
+        prevPeripheryRadius = getPeripheryRadius();
+    }
+    colorHistoryValid = historyValid && params.checkerboard;
+    traceFrame++;
 
-        // X Pass - spread in 2 passes along X and -X
-        glUseProgram(shaderDFGenX);
-        glUniform3ui(0, terrain->width, terrain->height, terrain->width);
-        glDispatchCompute(terrain->height / 64, terrain->width / 64, 1);
+    frameRecorder_captureFrame((uvec2) {resX, resY});
+    glfwSwapBuffers(window);
+}
 
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+void graphics_reloadShaders(void)
+{
+    if (shaderReloadPending && gllib_finishProgram(pendingTerrainInitial))
+        glDeleteProgram(pendingTerrainInitial);
+    shaderReloadPending = false;
 
-        // Y Pass - spread in 2 passes along Y and -Y
-        glUseProgram(shaderDFGenY);
-        glUniform3ui(0, terrain->width, terrain->height, terrain->width);
-        glDispatchCompute(terrain->width / 64, terrain->width / 64, 1);
+    if (fixedReloadPending)
+        for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+            if (gllib_finishProgram(pendingFixedShaders[i]))
+                glDeleteProgram(pendingFixedShaders[i]);
 
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        pendingFixedShaders[i] = gllib_startCompute(FIXED_SHADER_PATHS[i]);
+    fixedReloadPending = true;
 
-        glFinish();
-        u32 finish = uclock();
-        LOG_INFO("Building DF for %u x %u x %u nodes took: %.02fms", terrain->width / 8, terrain->height / 8, terrain->width / 8, (finish - start) / 1000.0f);
+    // only the variant in use is compiled in the background, all others are compiled again once they are needed
+    if (terrainVariantCount > 0)
+    {
+        strcpy(pendingTerrainDefines, currentTerrainDefines);
+        pendingTerrainInitial = gllib_startComputeVariant("res/shaders/compute/initial.glsl", pendingTerrainDefines);
+        shaderReloadPending = true;
     }
+    distanceField_reloadShaders();
+}
 
-    // render terrain (initial ray tracing)
-    glUseProgram(shaderTerrainInitial);
+bool graphics_drawViews(Terrain* terrain, const RenderView* views, u32 viewCount, const RenderSettings* settings, ViewRegion* regions)
+{
+    if (viewCount == 0)
+        return true;
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainChunkArraySSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, terrainPoolSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, terrainBitPoolSSBO);
+    applyRenderSettings(settings);
 
-    gllib_bindTexture(&texTerrainInitial, 0, GL_WRITE_ONLY);
+    // the views are placed left to right in rows (shelves) as high as their highest view
+    u32 width = MIN_ATLAS_WIDTH;
+    for (u32 i = 0; i < viewCount; i++)
+        width = max(width, views[i].size.x);
 
-    glUniform2ui(glGetUniformLocation(shaderTerrainInitial, "screenSize"), resX, resY);
-    glUniform3ui(glGetUniformLocation(shaderTerrainInitial, "terrainSize"), terrain->width, terrain->height, terrain->width);
-    glUniform3f(glGetUniformLocation(shaderTerrainInitial, "camPos"), camPos.x, camPos.y, camPos.z);
+    u32 x = 0;
+    u32 y = 0;
+    u32 shelfHeight = 0;
+    for (u32 i = 0; i < viewCount; i++)
+    {
+        if (x + views[i].size.x > width)
+        {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        regions[i] = (ViewRegion) {{x, y}, views[i].size};
+        x += views[i].size.x;
+        shelfHeight = max(shelfHeight, views[i].size.y);
+    }
+    u32 height = y + shelfHeight;
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderTerrainInitial, "viewMat"), 1, GL_FALSE, viewMat.arr);
-    glUniformMatrix4fv(glGetUniformLocation(shaderTerrainInitial, "projMat"), 1, GL_FALSE, projMat.arr);
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if (width > (u32) maxTextureSize || height > (u32) maxTextureSize)
+    {
+        LOG_ERROR("The atlas of %u views (%ux%u) exceeds the maximum texture size %d", viewCount, width, height, maxTextureSize);
+        return false;
+    }
 
-    glDispatchCompute(ceilf(resX / 8.0f), ceilf(resY / 8.0f), 1);
+    if (width > atlasWidth || height > atlasHeight)
+    {
+        if (atlasWidth != 0)
+            gllib_destroyTexture(&texAtlas);
+        atlasWidth = max(width, atlasWidth);
+        atlasHeight = max(height, atlasHeight);
+        texAtlas = gllib_makeDefaultTexture(atlasWidth, atlasHeight, GL_RGBA8, GL_NEAREST);
+    }
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    // the chunk cache streams around the first view
+    updateTerrain(terrain, views[0].camPos);
 
-    // blit compute output to screen
-    glBlitNamedFramebuffer(fbComputeTarget, 0,
-                           0, 0, resX, resY,
-                           0, 0, resX, resY,
-                           GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    GPUView* gpuViews = malloc(viewCount * sizeof(GPUView));
+    if (gpuViews == NULL)
+        PANIC("Could not allocate %u views", viewCount);
 
-    glfwSwapBuffers(window);
+    u32 totalTiles = 0;
+    for (u32 i = 0; i < viewCount; i++)
+    {
+        float fov = radians(views[i].fieldOfView > 0 ? views[i].fieldOfView : FIELD_OF_VIEW);
+        uvec2 size = views[i].size;
+        uvec2 fullSize = views[i].fullSize.x != 0 ? views[i].fullSize : size;
+        mat4 invProjMat = inversePerspectiveMatrix(fov, fullSize.x / (float) fullSize.y, 0.01, 1000);
+        u32 tilesX = (size.x + workGroupSize.x - 1) / workGroupSize.x;
+        u32 tilesY = (size.y + workGroupSize.y - 1) / workGroupSize.y;
+
+        gpuViews[i] = (GPUView) {
+                .invViewMat = inverseViewMatrix(views[i].camPos, views[i].forward),
+                .invProjMat = cropInverseProjection(invProjMat, views[i].cropOffset, size, fullSize),
+                .camPos = {views[i].camPos.x, views[i].camPos.y, views[i].camPos.z, 1},
+                .offset = regions[i].offset,
+                .size = size,
+                .firstTile = totalTiles,
+                .tilesX = tilesX,
+                .lodFactor = 2.0f * tanf(fov * 0.5f) / fullSize.y * appliedSettings.lodBias
+        };
+        totalTiles += tilesX * tilesY;
+    }
+
+    glNamedBufferData(viewSSBO, viewCount * sizeof(GPUView), gpuViews, GL_STREAM_DRAW);
+    free(gpuViews);
+
+    bindTraceBuffers();
+    gllib_bindTexture(&texAtlas, 0, GL_WRITE_ONLY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, viewSSBO);
+
+    // none of the screen space passes apply to the atlas
+    TraceParams params = {
+            .terrain = terrain,
+            .cooperative = appliedSettings.cooperativeTraversal,
+            .multiView = true
+    };
+
+    char defines[MAX_VARIANT_DEFINES];
+    buildTerrainDefines(&params, workGroupSize, defines);
+    u32 program = getTerrainVariant(defines);
+    glUseProgram(program);
+
+    glUniform1ui(glGetUniformLocation(program, "viewCount"), viewCount);
+    glUniform1ui(glGetUniformLocation(program, "totalTiles"), totalTiles);
+
+    u32 groupsX = min(totalTiles, 65535u);
+    glDispatchCompute(groupsX, (totalTiles + groupsX - 1) / groupsX, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    return true;
 }
 
-void graphics_reloadShaders(void)
+void graphics_readView(const ViewRegion* region, u8* rgba)
 {
-    loadShaders();
+    glGetTextureSubImage(texAtlas.handle, 0, region->offset.x, region->offset.y, 0, region->size.x, region->size.y, 1,
+                         GL_RGBA, GL_UNSIGNED_BYTE, region->size.x * region->size.y * 4, rgba);
+}
+
+void graphics_finishTerrainUpload(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings)
+{
+    do
+    {
+        graphics_drawFrame(terrain, camPos, forward, settings);
+    } while (terrain->dirty || distanceField_isRebuilding() || distanceField_isOutdated());
+}
+
+void graphics_benchmarkTraversal(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings, u32 runs)
+{
+    // both variants have to trace the same data
+    graphics_finishTerrainUpload(terrain, camPos, forward, settings);
+
+    mat4 invViewMat = inverseViewMatrix(camPos, forward);
+    mat4 invProjMat = inversePerspectiveMatrix(radians(FIELD_OF_VIEW), traceResX / (float) traceResY, 0.01, 1000);
+    float pixelSize = 2.0f * tanf(radians(FIELD_OF_VIEW) * 0.5f) / traceResY;
+
+    // the prepasses only change where the rays start, they are left out to compare the traversal itself
+    TraceParams params = {.terrain = terrain, .camPos = camPos, .invViewMat = invViewMat, .invProjMat = invProjMat,
+                          .lodFactor = pixelSize * settings->lodBias};
+    bindTraceBuffers();
+
+    float perRayMs = timeTrace(&params, runs);
+    params.persistent = true;
+    float persistentMs = timeTrace(&params, runs);
+    LOG_INFO("Traversal benchmark at %ux%u: per ray %.02fms, persistent threads %.02fms (%.02fx)",
+             traceResX, traceResY, perRayMs, persistentMs, perRayMs / persistentMs);
+
+    params.persistent = false;
+    params.cooperative = true;
+    float cooperativeMs = timeTrace(&params, runs);
+    LOG_INFO("Traversal benchmark at %ux%u: per ray %.02fms, cooperative %.02fms (%.02fx)",
+             traceResX, traceResY, perRayMs, cooperativeMs, perRayMs / cooperativeMs);
 }
 
 uvec2 graphics_getRes(void)
@@ -191,6 +639,166 @@ uvec2 graphics_getRes(void)
     return (uvec2) {resX, resY};
 }
 
+static void updateTerrain(Terrain* terrain, vec3 camPos)
+{
+    // switching between the full pools and the chunk cache requires a fresh upload
+    if (chunkCache_isEnabled() != poolsCached)
+        terrain->dirty = true;
+
+    // changes made while a sliced DF build runs wait for the next build
+    if (terrain->dirty && !distanceField_isRebuilding())
+    {
+        u64 poolByteSize = (u64) terrain->chunkPool.maxSize * terrain->chunkPool.unitSize;
+        u64 bitPoolByteSize = (u64) terrain->chunkBitmaskPool.maxSize * terrain->chunkBitmaskPool.unitSize;
+        u64 mipPoolByteSize = (u64) terrain->chunkPool.maxSize * CHUNK_MIP_WORDS * sizeof(u32);
+
+        // worlds whose pools don't fit into the cache budget can only be rendered through the cache
+        if (!chunkCache_isEnabled() && poolByteSize + bitPoolByteSize + mipPoolByteSize > chunkCache_getBudget())
+        {
+            LOG_INFO("Chunk pools exceed %u MB, using the chunk cache", (u32) (chunkCache_getBudget() >> 20));
+            chunkCache_setEnabled(true);
+        }
+
+        // new buffers can't serve the top level array in use, the DF is built right away then
+        bool wasCached = poolsCached;
+        poolsCached = chunkCache_isEnabled();
+        bool recreate = poolsCached != wasCached || (!poolsCached && currentPoolBufferSize == 0);
+
+        if (poolsCached)
+        {
+            // free the full pools, the cache only holds the chunks around the camera
+            if (currentPoolBufferSize != 0)
+            {
+                glNamedBufferData(terrainPoolSSBO, 0, NULL, GL_STATIC_DRAW);
+                glNamedBufferData(terrainBitPoolSSBO, 0, NULL, GL_STATIC_DRAW);
+                glNamedBufferData(terrainMipPoolSSBO, 0, NULL, GL_STATIC_DRAW);
+                currentPoolBufferSize = 0;
+            }
+        }
+        else
+        {
+            // releases the cache, if it was in use
+            if (wasCached)
+                chunkCache_reset(terrain);
+
+            if (currentPoolBufferSize == 0)
+            {
+                glNamedBufferData(terrainPoolSSBO, poolByteSize, NULL, GL_STATIC_DRAW);
+                glNamedBufferData(terrainBitPoolSSBO, bitPoolByteSize, NULL, GL_STATIC_DRAW);
+                glNamedBufferData(terrainMipPoolSSBO, mipPoolByteSize, NULL, GL_STATIC_DRAW);
+            }
+            else if (terrain->chunkPool.maxSize != currentPoolBufferSize)
+            {
+                // the old contents are still valid, they are copied over on the GPU
+                // the top level array in use doesn't reference the new slots, so the pools can grow during a build
+                gllib_growBuffer(&terrainPoolSSBO, (u64) currentPoolBufferSize * terrain->chunkPool.unitSize, poolByteSize, GL_STATIC_DRAW);
+                gllib_growBuffer(&terrainBitPoolSSBO, (u64) currentPoolBufferSize * terrain->chunkBitmaskPool.unitSize, bitPoolByteSize, GL_STATIC_DRAW);
+                gllib_growBuffer(&terrainMipPoolSSBO, (u64) currentPoolBufferSize * CHUNK_MIP_WORDS * sizeof(u32), mipPoolByteSize, GL_STATIC_DRAW);
+            }
+            currentPoolBufferSize = terrain->chunkPool.maxSize;
+        }
+
+        // only the chunks that changed are uploaded, once the top level array that references them is
+        pendingPoolBegin = recreate ? 0 : terrain->dirtyPoolBegin;
+        pendingPoolEnd = recreate ? terrain->chunkPool.maxSize : min(terrain->dirtyPoolEnd, terrain->chunkPool.maxSize);
+        terrain->dirtyPoolBegin = 0xFFFFFFFFu;
+        terrain->dirtyPoolEnd = 0;
+        terrain->dirty = false;
+
+        // the hits of the previous frame may not exist anymore
+        historyValid = false;
+        rasterPrepass_invalidate();
+
+        // update the top level array and generate the distance field
+        distanceField_rebuild(terrain, !recreate);
+        if (distanceField_isRebuilding())
+            snapshotPoolChanges(terrain);
+        else
+            applyPoolChanges(terrain);
+    }
+    else if (distanceField_isOutdated() && !distanceField_isRebuilding())
+    {
+        distanceField_rebuild(terrain, true);
+    }
+
+    // a finished sliced build swaps in its top level array here, before the next trace
+    if (distanceField_update())
+        applyPoolChanges(terrain);
+
+    // streaming reads the CPU pools, which only match the GPU while no changes are pending
+    if (!terrain->dirty && !distanceField_isRebuilding())
+        chunkCache_update(terrain, camPos);
+
+    updateShaderReload();
+}
+
+// a sliced build keeps tracing the old top level array for a few frames, uploading the changed chunks right away would
+// let its entries point at slots that terrain_setBlock freed and handed to other chunks, so they are copied and uploaded at the swap
+static void snapshotPoolChanges(const Terrain* terrain)
+{
+    if (pendingPoolBegin >= pendingPoolEnd)
+        return;
+
+    u32 count = pendingPoolEnd - pendingPoolBegin;
+    u32 usedPoolSize = terrain->chunkPool.maxSize - terrain->chunkPool.unused;
+
+    pendingPoolData = malloc((u64) count * terrain->chunkPool.unitSize);
+    pendingBitmaskData = malloc((u64) count * terrain->chunkBitmaskPool.unitSize);
+    pendingMipData = calloc((u64) count * CHUNK_MIP_WORDS, sizeof(u32));
+    if (pendingPoolData == NULL || pendingBitmaskData == NULL || pendingMipData == NULL)
+        PANIC("Could not allocate %u pending chunks", count);
+
+    memcpy(pendingPoolData, poolAllocatorGet(&terrain->chunkPool, pendingPoolBegin), (u64) count * terrain->chunkPool.unitSize);
+    memcpy(pendingBitmaskData, poolAllocatorGet(&terrain->chunkBitmaskPool, pendingPoolBegin), (u64) count * terrain->chunkBitmaskPool.unitSize);
+
+    // slots past the used ones were never handed out, their mips stay empty
+    for (u32 i = pendingPoolBegin; i < min(pendingPoolEnd, usedPoolSize); i++)
+        terrain_buildChunkMips(terrain, i, pendingMipData + (u64) (i - pendingPoolBegin) * CHUNK_MIP_WORDS);
+}
+
+// uploads the chunks of the last DF build, from the snapshot if the build was sliced
+static void applyPoolChanges(const Terrain* terrain)
+{
+    if (pendingPoolBegin < pendingPoolEnd)
+    {
+        u32 count = pendingPoolEnd - pendingPoolBegin;
+        bool snapshot = pendingPoolData != NULL;
+
+        if (poolsCached)
+        {
+            chunkCache_refresh(terrain, pendingPoolBegin, pendingPoolEnd, pendingPoolData, pendingBitmaskData, pendingMipData);
+        }
+        else
+        {
+            gllib_stagingUpload(&uploadRing, terrainPoolSSBO, (u64) pendingPoolBegin * terrain->chunkPool.unitSize,
+                                snapshot ? pendingPoolData : poolAllocatorGet(&terrain->chunkPool, pendingPoolBegin),
+                                (u64) count * terrain->chunkPool.unitSize);
+            gllib_stagingUpload(&uploadRing, terrainBitPoolSSBO, (u64) pendingPoolBegin * terrain->chunkBitmaskPool.unitSize,
+                                snapshot ? pendingBitmaskData : poolAllocatorGet(&terrain->chunkBitmaskPool, pendingPoolBegin),
+                                (u64) count * terrain->chunkBitmaskPool.unitSize);
+
+            if (snapshot)
+            {
+                gllib_stagingUpload(&uploadRing, terrainMipPoolSSBO, (u64) pendingPoolBegin * CHUNK_MIP_WORDS * sizeof(u32),
+                                    pendingMipData, (u64) count * CHUNK_MIP_WORDS * sizeof(u32));
+            }
+            else
+            {
+                uploadChunkMips(terrain, pendingPoolBegin, pendingPoolEnd);
+            }
+        }
+    }
+
+    free(pendingPoolData);
+    free(pendingBitmaskData);
+    free(pendingMipData);
+    pendingPoolData = NULL;
+    pendingBitmaskData = NULL;
+    pendingMipData = NULL;
+    pendingPoolBegin = 0xFFFFFFFFu;
+    pendingPoolEnd = 0;
+}
+
 static void createWindowAndContext(void)
 {
     glfwInit();
@@ -226,6 +834,8 @@ static void createWindowAndContext(void)
         exit(-1);
     }
 
+    gllib_init((GllibLoadProc) glfwGetProcAddress);
+
     int flags; glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
     if (flags & GL_CONTEXT_FLAG_DEBUG_BIT)
     {
@@ -246,16 +856,24 @@ static void freeWindowAndContext(void)
 
 static void createWorldResources(void)
 {
-    glCreateBuffers(1, &terrainChunkArraySSBO);
     glCreateBuffers(1, &terrainPoolSSBO);
     glCreateBuffers(1, &terrainBitPoolSSBO);
+    glCreateBuffers(1, &terrainMipPoolSSBO);
+    uploadRing = gllib_makeStagingRing(UPLOAD_RING_SIZE);
+    distanceField_init(&uploadRing);
+    chunkCache_init(&uploadRing);
+    rasterPrepass_init();
 }
 
 static void freeWorldResources(void)
 {
-    glDeleteBuffers(1, &terrainChunkArraySSBO);
     glDeleteBuffers(1, &terrainPoolSSBO);
     glDeleteBuffers(1, &terrainBitPoolSSBO);
+    glDeleteBuffers(1, &terrainMipPoolSSBO);
+    distanceField_destroy();
+    chunkCache_destroy();
+    rasterPrepass_destroy();
+    gllib_destroyStagingRing(&uploadRing);
 }
 
 static void createSizeAwareResources(void)
@@ -263,10 +881,25 @@ static void createSizeAwareResources(void)
     if (renderingResourcesCreated)
         freeSizeAwareResources();
 
-    texTerrainInitial = gllib_makeDefaultTexture(resX, resY, GL_RGBA8, GL_NEAREST);
+    traceResX = max(1u, (u32) (resX * resolutionScale));
+    traceResY = max(1u, (u32) (resY * resolutionScale));
+
+    texTerrainInitial = gllib_makeDefaultTexture(traceResX, traceResY, GL_RGBA8, GL_NEAREST);
+    texTerrainDepth = gllib_makeDefaultTexture(traceResX, traceResY, GL_RG32F, GL_NEAREST);
+    texPrevTerrainDepth = gllib_makeDefaultTexture(traceResX, traceResY, GL_RG32F, GL_NEAREST);
+    texReprojectedDepth = gllib_makeDefaultTexture(traceResX, traceResY, GL_R32UI, 0);
+    texTileStart = gllib_makeDefaultTexture((traceResX + CONE_TILE_SIZE - 1) / CONE_TILE_SIZE, (traceResY + CONE_TILE_SIZE - 1) / CONE_TILE_SIZE,
+                                            GL_R32F, GL_NEAREST);
+    texRasterStart = gllib_makeDefaultTexture(traceResX, traceResY, GL_R32F, GL_NEAREST);
+    texPrevColor = gllib_makeDefaultTexture(traceResX, traceResY, GL_RGBA8, GL_NEAREST);
+    texGBuffer = gllib_makeDefaultTexture(traceResX, traceResY, GL_RGBA32UI, 0);
+    colorHistoryValid = false;
+    historyValid = false;
+    texUpsampled = gllib_makeDefaultTexture(resX, resY, GL_RGBA8, GL_NEAREST);
 
     // bind final compute output to framebuffer, so it can be blit to screen
     glNamedFramebufferTexture(fbComputeTarget,  GL_COLOR_ATTACHMENT0, texTerrainInitial.handle, 0);
+    glNamedFramebufferTexture(fbUpsampleTarget,  GL_COLOR_ATTACHMENT0, texUpsampled.handle, 0);
 
     renderingResourcesCreated = true;
 }
@@ -277,6 +910,14 @@ static void freeSizeAwareResources(void)
         return;
 
     gllib_destroyTexture(&texTerrainInitial);
+    gllib_destroyTexture(&texTerrainDepth);
+    gllib_destroyTexture(&texPrevTerrainDepth);
+    gllib_destroyTexture(&texReprojectedDepth);
+    gllib_destroyTexture(&texTileStart);
+    gllib_destroyTexture(&texRasterStart);
+    gllib_destroyTexture(&texPrevColor);
+    gllib_destroyTexture(&texGBuffer);
+    gllib_destroyTexture(&texUpsampled);
 
     renderingResourcesCreated = false;
 }
@@ -284,11 +925,233 @@ static void freeSizeAwareResources(void)
 static void createPermanentResources(void)
 {
     glCreateFramebuffers(1, &fbComputeTarget);
+    glCreateFramebuffers(1, &fbUpsampleTarget);
+    glCreateBuffers(1, &rayQueueSSBO);
+    glCreateBuffers(1, &viewSSBO);
+    glNamedBufferData(rayQueueSSBO, sizeof(u32), NULL, GL_DYNAMIC_DRAW);
+    glCreateQueries(GL_TIME_ELAPSED, STATS_QUERY_COUNT, traceQueries);
+    workGroupTuner_init();
 }
 
 static void freePermanentResources(void)
 {
     glDeleteFramebuffers(1, &fbComputeTarget);
+    glDeleteFramebuffers(1, &fbUpsampleTarget);
+    glDeleteBuffers(1, &rayQueueSSBO);
+    glDeleteBuffers(1, &viewSSBO);
+    if (atlasWidth != 0)
+        gllib_destroyTexture(&texAtlas);
+    atlasWidth = 0;
+    atlasHeight = 0;
+    glDeleteQueries(STATS_QUERY_COUNT, traceQueries);
+    workGroupTuner_destroy();
+}
+
+static void applyRenderSettings(const RenderSettings* settings)
+{
+    // only changed settings are forwarded, so changes made by the modules themselves (e.g. forcing the chunk cache) stick
+    const RenderSettings* old = settingsApplied ? &appliedSettings : NULL;
+
+    if (!old || settings->dfMode != old->dfMode)
+        distanceField_setMode(settings->dfMode);
+
+    if (!old || settings->octantDF != old->octantDF)
+        distanceField_setOctant(settings->octantDF);
+
+    if (!old || settings->parallelDFBuild != old->parallelDFBuild)
+        distanceField_setParallelBuild(settings->parallelDFBuild);
+
+    if (!old || settings->slicedDFBuild != old->slicedDFBuild || settings->slicedDFBudgetMs != old->slicedDFBudgetMs)
+        distanceField_setSliced(settings->slicedDFBuild, settings->slicedDFBudgetMs);
+
+    if (!old || settings->chunkCache != old->chunkCache)
+        chunkCache_setEnabled(settings->chunkCache);
+
+    if (!old || settings->workGroupSize.x != old->workGroupSize.x || settings->workGroupSize.y != old->workGroupSize.y)
+    {
+        // 0x0 selects the tuned size, which is looked up (or measured) again on the next frame
+        uvec2 size = settings->workGroupSize;
+        autoWorkGroupSize = size.x == 0 && size.y == 0;
+        if (autoWorkGroupSize)
+        {
+            tunedTerrainSize = (uvec2) {0, 0};
+        }
+        else if (size.x == 0 || size.y == 0 || size.x * size.y > 1024)
+        {
+            LOG_WARNING("Invalid workgroup size %ux%u, keeping %ux%u", size.x, size.y, workGroupSize.x, workGroupSize.y);
+        }
+        else
+        {
+            workGroupSize = size;
+        }
+    }
+
+    float scale = max(0.25f, min(2.0f, settings->resolutionScale));
+    if (scale != resolutionScale)
+    {
+        resolutionScale = scale;
+        createSizeAwareResources();
+    }
+
+    if (settings->stats && (!old || !old->stats))
+    {
+        statsStartTime = glfwGetTime();
+        statsTraceMs = 0;
+        statsFrameCount = 0;
+    }
+
+    appliedSettings = *settings;
+    settingsApplied = true;
+}
+
+static bool isUpsampling(void)
+{
+    return appliedSettings.upsample && resolutionScale < 1;
+}
+
+static bool isWritingDepth(void)
+{
+    return isUpsampling() || appliedSettings.reprojection || appliedSettings.checkerboard;
+}
+
+static void reprojectHistory(vec3 camPos, mat4 viewProjMat)
+{
+    const u32 noHit = 0xFFFFFFFFu;
+    glClearTexImage(texReprojectedDepth.handle, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &noHit);
+
+    glUseProgram(shaderReproject);
+
+    gllib_bindTexture(&texPrevTerrainDepth, 0, GL_READ_ONLY);
+    gllib_bindTexture(&texReprojectedDepth, 1, GL_READ_WRITE);
+
+    glUniform2ui(glGetUniformLocation(shaderReproject, "screenSize"), traceResX, traceResY);
+    glUniform3f(glGetUniformLocation(shaderReproject, "prevCamPos"), prevCamPos.x, prevCamPos.y, prevCamPos.z);
+    glUniformMatrix4fv(glGetUniformLocation(shaderReproject, "prevInvViewMat"), 1, GL_FALSE, prevInvViewMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(shaderReproject, "prevInvProjMat"), 1, GL_FALSE, prevInvProjMat.arr);
+    glUniform3f(glGetUniformLocation(shaderReproject, "camPos"), camPos.x, camPos.y, camPos.z);
+    glUniformMatrix4fv(glGetUniformLocation(shaderReproject, "viewProjMat"), 1, GL_FALSE, viewProjMat.arr);
+    glUniform1i(glGetUniformLocation(shaderReproject, "checkerboard"), prevCheckerboard);
+    glUniform1ui(glGetUniformLocation(shaderReproject, "prevTraceFrame"), prevTraceFrame);
+    glUniform1f(glGetUniformLocation(shaderReproject, "prevPeripheryRadius"), prevPeripheryRadius);
+
+    glDispatchCompute((traceResX + 7) / 8, (traceResY + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+static void traceTileCones(const TraceParams* params)
+{
+    // the top level array and the tile image are bound by bindTraceBuffers
+    glUseProgram(shaderConePrepass);
+
+    const Terrain* terrain = params->terrain;
+    glUniform2ui(glGetUniformLocation(shaderConePrepass, "screenSize"), traceResX, traceResY);
+    glUniform3ui(glGetUniformLocation(shaderConePrepass, "terrainSize"), terrain->width, terrain->height, terrain->width);
+    glUniform3f(glGetUniformLocation(shaderConePrepass, "camPos"), params->camPos.x, params->camPos.y, params->camPos.z);
+    glUniformMatrix4fv(glGetUniformLocation(shaderConePrepass, "invViewMat"), 1, GL_FALSE, params->invViewMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(shaderConePrepass, "invProjMat"), 1, GL_FALSE, params->invProjMat.arr);
+    glUniform1ui(glGetUniformLocation(shaderConePrepass, "dfMode"), distanceField_getActiveMode());
+
+    u32 tilesX = (traceResX + CONE_TILE_SIZE - 1) / CONE_TILE_SIZE;
+    u32 tilesY = (traceResY + CONE_TILE_SIZE - 1) / CONE_TILE_SIZE;
+    glDispatchCompute((tilesX + 7) / 8, (tilesY + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+static void resolveCheckerboard(vec3 camPos, mat4 invViewMat, mat4 invProjMat, mat4 viewProjMat)
+{
+    glUseProgram(shaderCheckerboardResolve);
+
+    gllib_bindTexture(&texTerrainInitial, 0, GL_READ_WRITE);
+    gllib_bindTexture(&texTerrainDepth, 1, GL_READ_WRITE);
+    gllib_bindTexture(&texPrevColor, 2, GL_READ_ONLY);
+    gllib_bindTexture(&texPrevTerrainDepth, 3, GL_READ_ONLY);
+
+    u32 program = shaderCheckerboardResolve;
+    glUniform2ui(glGetUniformLocation(program, "screenSize"), traceResX, traceResY);
+    glUniform1ui(glGetUniformLocation(program, "traceFrame"), traceFrame);
+    glUniform1f(glGetUniformLocation(program, "peripheryRadius"), getPeripheryRadius());
+    glUniform3f(glGetUniformLocation(program, "camPos"), camPos.x, camPos.y, camPos.z);
+    glUniformMatrix4fv(glGetUniformLocation(program, "invViewMat"), 1, GL_FALSE, invViewMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(program, "invProjMat"), 1, GL_FALSE, invProjMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewProjMat"), 1, GL_FALSE, viewProjMat.arr);
+
+    glUniform1i(glGetUniformLocation(program, "historyValid"), colorHistoryValid && historyValid);
+    glUniform3f(glGetUniformLocation(program, "prevCamPos"), prevCamPos.x, prevCamPos.y, prevCamPos.z);
+    glUniformMatrix4fv(glGetUniformLocation(program, "prevInvViewMat"), 1, GL_FALSE, prevInvViewMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(program, "prevInvProjMat"), 1, GL_FALSE, prevInvProjMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(program, "prevViewProjMat"), 1, GL_FALSE, prevViewProjMat.arr);
+
+    glDispatchCompute((traceResX + 7) / 8, (traceResY + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+}
+
+static void shadeGBuffer(void)
+{
+    glUseProgram(shaderShade);
+
+    gllib_bindTexture(&texGBuffer, 0, GL_READ_ONLY);
+    gllib_bindTexture(&texTerrainInitial, 1, GL_WRITE_ONLY);
+
+    glUniform2ui(glGetUniformLocation(shaderShade, "screenSize"), traceResX, traceResY);
+    glUniform1f(glGetUniformLocation(shaderShade, "fogDistance"), appliedSettings.fogDistance);
+
+    glDispatchCompute((traceResX + 7) / 8, (traceResY + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+static float getPeripheryRadius(void)
+{
+    // a radius that covers the whole screen traces the full checkerboard everywhere
+    return appliedSettings.peripheryRadius > 0 ? appliedSettings.peripheryRadius : 1e9f;
+}
+
+static void upsample(void)
+{
+    glUseProgram(shaderUpsample);
+
+    gllib_bindTexture(&texTerrainInitial, 0, GL_READ_ONLY);
+    gllib_bindTexture(&texTerrainDepth, 1, GL_READ_ONLY);
+    gllib_bindTexture(&texUpsampled, 2, GL_WRITE_ONLY);
+
+    glUniform2ui(glGetUniformLocation(shaderUpsample, "lowSize"), traceResX, traceResY);
+    glUniform2ui(glGetUniformLocation(shaderUpsample, "outSize"), resX, resY);
+
+    glDispatchCompute((resX + 7) / 8, (resY + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+}
+
+static void collectTraceStats(void)
+{
+    // results of disabled stats are still collected, so the queries can be reused
+    for (u32 i = 0; i < STATS_QUERY_COUNT; i++)
+    {
+        if (!traceQueryPending[i])
+            continue;
+
+        i32 available = 0;
+        glGetQueryObjectiv(traceQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        u64 elapsedNs = 0;
+        glGetQueryObjectui64v(traceQueries[i], GL_QUERY_RESULT, &elapsedNs);
+        traceQueryPending[i] = false;
+
+        statsTraceMs += elapsedNs / 1000000.0;
+        statsFrameCount++;
+    }
+
+    if (!appliedSettings.stats || glfwGetTime() - statsStartTime < 1.0 || statsFrameCount == 0)
+        return;
+
+    double traceMs = statsTraceMs / statsFrameCount;
+    // the periphery isn't counted, its share depends on the radius
+    double rays = appliedSettings.checkerboard ? traceResX * traceResY * 0.5 : traceResX * traceResY;
+    LOG_INFO("Trace: %.2fms at %ux%u (%.0f Mrays/s)", traceMs, traceResX, traceResY, rays / (traceMs * 1000.0));
+
+    statsStartTime = glfwGetTime();
+    statsTraceMs = 0;
+    statsFrameCount = 0;
 }
 
 static void loadShaders(void)
@@ -296,29 +1159,334 @@ static void loadShaders(void)
     if (shadersLoaded)
         freeShaders();
 
-    shaderTerrainInitial = gllib_makeCompute("res/shaders/compute/initial.glsl");
-    shaderDFGenPrepare = gllib_makeCompute("res/shaders/compute/dfGenPrepare.glsl");
-    shaderDFGenX = gllib_makeCompute("res/shaders/compute/dfGenXPass.glsl");
-    shaderDFGenY = gllib_makeCompute("res/shaders/compute/dfGenYPass.glsl");
-    shaderDFGenZ = gllib_makeCompute("res/shaders/compute/dfGenZPass.glsl");
+    // the variants of the terrain shader are compiled on first use
+    for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        *fixedShaderSlots[i] = gllib_startCompute(FIXED_SHADER_PATHS[i]);
+
+    distanceField_loadShaders();
+    rasterPrepass_loadShaders();
+
+    for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        if (!gllib_finishProgram(*fixedShaderSlots[i]))
+            exit(-1);
 
     shadersLoaded = true;
 }
 
+static void updateShaderReload(void)
+{
+    bool fixedReady = fixedReloadPending;
+    for (u32 i = 0; i < FIXED_SHADER_COUNT && fixedReady; i++)
+        fixedReady = gllib_isProgramReady(pendingFixedShaders[i]);
+
+    if (fixedReady)
+    {
+        fixedReloadPending = false;
+
+        bool success = true;
+        bool finished[FIXED_SHADER_COUNT];
+        for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        {
+            finished[i] = gllib_finishProgram(pendingFixedShaders[i]);
+            success &= finished[i];
+        }
+
+        // the screen space shaders are only replaced together
+        for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        {
+            if (success)
+            {
+                glDeleteProgram(*fixedShaderSlots[i]);
+                *fixedShaderSlots[i] = pendingFixedShaders[i];
+            }
+            else if (finished[i])
+            {
+                glDeleteProgram(pendingFixedShaders[i]);
+            }
+        }
+
+        if (!success)
+            LOG_ERROR("Reloading the screen space shaders failed, the previous ones stay in use");
+    }
+
+    if (!shaderReloadPending || !gllib_isProgramReady(pendingTerrainInitial))
+        return;
+
+    shaderReloadPending = false;
+    if (!gllib_finishProgram(pendingTerrainInitial))
+    {
+        LOG_ERROR("Reloading the terrain shader failed, the previous one stays in use");
+        return;
+    }
+
+    freeTerrainVariants();
+    strcpy(terrainVariants[0].defines, pendingTerrainDefines);
+    terrainVariants[0].program = pendingTerrainInitial;
+    terrainVariantCount = 1;
+}
+
+static void buildTerrainDefines(const TraceParams* params, uvec2 groupSize, char* defines)
+{
+    snprintf(defines, MAX_VARIANT_DEFINES,
+             "#define LOCAL_SIZE_X %u\n"
+             "#define LOCAL_SIZE_Y %u\n"
+             "#define TERRAIN_SIZE uvec3(%u, %u, %u)\n"
+             "#define DF_MODE %u\n"
+             "#define USE_OCTANT_DF %u\n"
+             "#define USE_CHUNK_CACHE %u\n"
+             "#define USE_LOD %u\n"
+             "%s%s%s%s%s%s%s%s%s%s",
+             groupSize.x, groupSize.y,
+             params->terrain->width, params->terrain->height, params->terrain->width,
+             distanceField_getActiveMode(),
+             distanceField_getActiveOctant(),
+             poolsCached,
+             appliedSettings.lodBias > 0,
+             appliedSettings.heatmap ? "#define HEATMAP\n" : "",
+             params->writeDepth ? "#define WRITE_DEPTH\n" : "",
+             params->reproject ? "#define REPROJECT\n" : "",
+             params->conePrepass ? "#define CONE_PREPASS\n" : "",
+             params->rasterPrepass ? "#define RASTER_PREPASS\n" : "",
+             params->checkerboard ? "#define CHECKERBOARD\n" : "",
+             params->gBuffer ? "#define GBUFFER\n" : "",
+             params->cooperative ? "#define COOPERATIVE\n" : "",
+             params->persistent ? "#define PERSISTENT\n" : "",
+             params->multiView ? "#define MULTI_VIEW\n" : "");
+}
+
+static void bindTraceBuffers(void)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, distanceField_getChunkArrayBuffer());
+    if (poolsCached)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, chunkCache_getDataBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, chunkCache_getBitmaskBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, chunkCache_getIndirectionBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, chunkCache_getMipBuffer());
+    }
+    else
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, terrainPoolSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, terrainBitPoolSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, terrainMipPoolSSBO);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, distanceField_getOctantBuffer());
+
+    gllib_bindTexture(&texTerrainInitial, 0, GL_WRITE_ONLY);
+    gllib_bindTexture(&texTerrainDepth, 1, GL_WRITE_ONLY);
+    gllib_bindTexture(&texReprojectedDepth, 2, GL_READ_ONLY);
+    gllib_bindTexture(&texPrevTerrainDepth, 3, GL_READ_ONLY);
+    gllib_bindTexture(&texTileStart, 4, GL_READ_WRITE);
+    gllib_bindTexture(&texRasterStart, 5, GL_READ_ONLY);
+    gllib_bindTexture(&texGBuffer, 6, GL_WRITE_ONLY);
+}
+
+// defines receives the define set of the variant that was used
+static void traceTerrain(const TraceParams* params, uvec2 groupSize, char* defines)
+{
+    buildTerrainDefines(params, groupSize, defines);
+    u32 program = getTerrainVariant(defines);
+    glUseProgram(program);
+
+    glUniform2ui(glGetUniformLocation(program, "screenSize"), traceResX, traceResY);
+    glUniform3f(glGetUniformLocation(program, "camPos"), params->camPos.x, params->camPos.y, params->camPos.z);
+    glUniform1f(glGetUniformLocation(program, "lodFactor"), params->lodFactor);
+    glUniformMatrix4fv(glGetUniformLocation(program, "invViewMat"), 1, GL_FALSE, params->invViewMat.arr);
+    glUniformMatrix4fv(glGetUniformLocation(program, "invProjMat"), 1, GL_FALSE, params->invProjMat.arr);
+
+    if (params->reproject)
+    {
+        glUniform3f(glGetUniformLocation(program, "prevCamPos"), prevCamPos.x, prevCamPos.y, prevCamPos.z);
+        glUniformMatrix4fv(glGetUniformLocation(program, "prevViewProjMat"), 1, GL_FALSE, prevViewProjMat.arr);
+        glUniform1i(glGetUniformLocation(program, "prevCheckerboard"), prevCheckerboard);
+        glUniform1ui(glGetUniformLocation(program, "prevTraceFrame"), prevTraceFrame);
+        glUniform1f(glGetUniformLocation(program, "prevPeripheryRadius"), prevPeripheryRadius);
+    }
+
+    // a checkerboard only covers half of every row
+    u32 dispatchX = traceResX;
+    if (params->checkerboard)
+    {
+        glUniform1ui(glGetUniformLocation(program, "traceFrame"), traceFrame);
+        glUniform1f(glGetUniformLocation(program, "peripheryRadius"), getPeripheryRadius());
+        dispatchX = (traceResX + 1) / 2;
+    }
+
+    u32 groupsX = (dispatchX + groupSize.x - 1) / groupSize.x;
+    u32 groupsY = (traceResY + groupSize.y - 1) / groupSize.y;
+    if (params->persistent)
+    {
+        // the atomics of the previous trace have to be done before the queue is reset
+        const u32 zero = 0;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glClearNamedBufferData(rayQueueSSBO, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, rayQueueSSBO);
+
+        glUniform2ui(glGetUniformLocation(program, "tileCount"), groupsX, groupsY);
+        glDispatchCompute(min(groupsX * groupsY, getPersistentGroupCount(groupSize)), 1, 1);
+        return;
+    }
+
+    glDispatchCompute(groupsX, groupsY, 1);
+}
+
+// more workgroups than fit on the GPU only find the queue empty, fewer leave parts of it idle
+static u32 getPersistentGroupCount(uvec2 groupSize)
+{
+    if (appliedSettings.persistentGroupCount > 0)
+        return appliedSettings.persistentGroupCount;
+
+    u32 residentGroups = gllib_getResidentWorkGroups(groupSize.x * groupSize.y);
+    return residentGroups > 0 ? residentGroups : DEFAULT_PERSISTENT_GROUP_COUNT;
+}
+
+static void benchTrace(uvec2 groupSize, void* userData)
+{
+    char defines[MAX_VARIANT_DEFINES];
+    traceTerrain(userData, groupSize, defines);
+}
+
+// returns the average GPU time of the tracing pass in ms
+static float timeTrace(const TraceParams* params, u32 runs)
+{
+    u32 query;
+    glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+    // the warm up run also compiles the variant
+    char defines[MAX_VARIANT_DEFINES];
+    traceTerrain(params, workGroupSize, defines);
+
+    u64 totalNs = 0;
+    for (u32 i = 0; i < runs; i++)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        traceTerrain(params, workGroupSize, defines);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        totalNs += ns;
+    }
+
+    glDeleteQueries(1, &query);
+    return totalNs / (float) runs / 1000000.0f;
+}
+
+static u32 getTerrainVariant(const char* defines)
+{
+    for (u32 i = 0; i < terrainVariantCount; i++)
+        if (strcmp(terrainVariants[i].defines, defines) == 0)
+            return terrainVariants[i].program;
+
+    // the setting has to take effect this frame, so a new variant is compiled right away (usually from the binary cache)
+    u32 idx = terrainVariantCount;
+    if (terrainVariantCount == MAX_SHADER_VARIANTS)
+    {
+        idx = nextVariantEviction;
+        nextVariantEviction = (nextVariantEviction + 1) % MAX_SHADER_VARIANTS;
+        glDeleteProgram(terrainVariants[idx].program);
+    }
+    else
+    {
+        terrainVariantCount++;
+    }
+
+    strcpy(terrainVariants[idx].defines, defines);
+    terrainVariants[idx].program = gllib_makeComputeVariant("res/shaders/compute/initial.glsl", defines);
+    return terrainVariants[idx].program;
+}
+
+static void freeTerrainVariants(void)
+{
+    for (u32 i = 0; i < terrainVariantCount; i++)
+        glDeleteProgram(terrainVariants[i].program);
+
+    terrainVariantCount = 0;
+    nextVariantEviction = 0;
+}
+
 static void freeShaders(void)
 {
     if (!shadersLoaded)
         return;
 
-    glDeleteProgram(shaderTerrainInitial);
-    glDeleteProgram(shaderDFGenPrepare);
-    glDeleteProgram(shaderDFGenX);
-    glDeleteProgram(shaderDFGenY);
-    glDeleteProgram(shaderDFGenZ);
+    freeTerrainVariants();
+    for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+        glDeleteProgram(*fixedShaderSlots[i]);
+    distanceField_freeShaders();
+    rasterPrepass_freeShaders();
+
+    if (shaderReloadPending && gllib_finishProgram(pendingTerrainInitial))
+        glDeleteProgram(pendingTerrainInitial);
+    shaderReloadPending = false;
+
+    if (fixedReloadPending)
+        for (u32 i = 0; i < FIXED_SHADER_COUNT; i++)
+            if (gllib_finishProgram(pendingFixedShaders[i]))
+                glDeleteProgram(pendingFixedShaders[i]);
+    fixedReloadPending = false;
 
     shadersLoaded = false;
 }
 
+static mat4 inverseViewMatrix(vec3 camPos, vec3 forward)
+{
+    // inverse of worldToCamMatrix: the transposed rotation followed by the translation to the camera
+    const vec3 globalUp = {0, 1, 0};
+    const vec3 right = normalize(cross(forward, globalUp));
+    const vec3 up = normalize(cross(right, forward));
+    const vec3 backward = normalize(mul(forward, -1.0f));
+
+    return (mat4) {
+            right.x, right.y, right.z, 0,
+            up.x, up.y, up.z, 0,
+            backward.x, backward.y, backward.z, 0,
+            camPos.x, camPos.y, camPos.z, 1
+    };
+}
+
+static mat4 inversePerspectiveMatrix(float fov, float aspectRatio, float zNear, float zFar)
+{
+    // inverse of perspectiveProjectionMatrix
+    const float tanFovHalf = tanf(fov / 2.0f);
+    const float c = (zFar + zNear) / (zNear - zFar);
+    const float d = 2 * zFar * zNear / (zNear - zFar);
+
+    return (mat4) {
+            aspectRatio * tanFovHalf, 0, 0, 0,
+            0, tanFovHalf, 0, 0,
+            0, 0, 0, 1 / d,
+            0, 0, -1, c / d
+    };
+}
+
+// maps the screen of a cropped part onto the screen of the full image: x' = x * size / fullSize + (2 * offset + size) / fullSize - 1
+static mat4 cropInverseProjection(mat4 invProjMat, uvec2 offset, uvec2 size, uvec2 fullSize)
+{
+    invProjMat.m03 += invProjMat.m00 * ((2.0f * offset.x + size.x) / fullSize.x - 1);
+    invProjMat.m13 += invProjMat.m11 * ((2.0f * offset.y + size.y) / fullSize.y - 1);
+    invProjMat.m00 *= size.x / (float) fullSize.x;
+    invProjMat.m11 *= size.y / (float) fullSize.y;
+    return invProjMat;
+}
+
+static void uploadChunkMips(const Terrain* terrain, u32 begin, u32 end)
+{
+    static u32 mips[MIP_UPLOAD_BATCH * CHUNK_MIP_WORDS];
+
+    // slots past this were never handed out, their memory is uninitialized
+    end = min(end, terrain->chunkPool.maxSize - terrain->chunkPool.unused);
+
+    for (u32 batch = begin; batch < end; batch += MIP_UPLOAD_BATCH)
+    {
+        u32 count = min(end - batch, (u32) MIP_UPLOAD_BATCH);
+        for (u32 i = 0; i < count; i++)
+            terrain_buildChunkMips(terrain, batch + i, mips + i * CHUNK_MIP_WORDS);
+
+        gllib_stagingUpload(&uploadRing, terrainMipPoolSSBO, (u64) batch * CHUNK_MIP_WORDS * sizeof(u32), mips, count * CHUNK_MIP_WORDS * sizeof(u32));
+    }
+}
+
 static void framebuffer_size_callback(GLFWwindow* w, int width, int height)
 {
     glViewport(0, 0, width, height);
@@ -1,7 +1,14 @@
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include "graphics.h"
+#include "distance_field.h"
+#include "chunk_cache.h"
 #include "terrain.h"
+#include "render_server.h"
+#include "tile_coordinator.h"
+#include "tiled_capture.h"
+#include "frame_recorder.h"
 #include "cplog.h"
 #include "GLFW/glfw3.h"
 #include "cptime.h"
@@ -10,24 +17,67 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 
 static void updateCamera(float dTimeS);
 
+static void benchmarkDistanceField(void);
+
+// what the command line asks for besides the render settings
+typedef struct Options
+{
+    u32 width;
+    bool benchDF;
+    bool benchTrace;
+    // serves render jobs on this address (socket path or host:port) instead of opening the interactive view
+    const char* servePath;
+    // comma separated addresses of the render servers that trace an image of imageSize into outputPath
+    char* workers;
+    // traces an image of imageSize into outputPath on this GPU and exits (K captures one from the interactive view)
+    bool capture;
+    uvec2 imageSize;
+    const char* outputPath;
+    // records the interactive view as raw frames into this file (or command, see frame_recorder.h)
+    const char* recordPath;
+} Options;
+
+static bool parseArgs(int argc, char* argv[], Options* options);
+
+static bool renderOnWorkers(const Options* options);
+
+static void resetCamera(u32 terrainWidth, u32 terrainHeight);
+
+static const u32 TERRAIN_HEIGHT = 256;
+
+static bool captureRequested = false;
+
 static vec3 camPos;
 static vec3 forward;
 
+static RenderSettings settings;
+
 int main(int argc, char* argv[])
 {
-    graphics_init();
+    settings = graphics_defaultRenderSettings();
 
-    Terrain terrain;
+    Options options = {.width = 1024, .imageSize = {7680, 4320}, .outputPath = "image.ppm"};
+    if (!parseArgs(argc, argv, &options))
+        return -1;
 
-    u32 width = 1024;
-    if (argc > 1)
+    // the coordinator only assembles the tiles, it doesn't trace anything itself
+    if (options.workers != NULL)
+        return renderOnWorkers(&options) ? 0 : -1;
+
+    graphics_init();
+
+    if (options.benchDF)
     {
-        width = atoi(argv[1]);
+        benchmarkDistanceField();
+        graphics_destroy();
+        return 0;
     }
 
+    Terrain terrain;
+
     // generate terrain
     u32 start = clock();
-    terrain_init(&terrain, width, 256);
+    terrain_init(&terrain, options.width, TERRAIN_HEIGHT);
     u32 stop = clock();
 
     // calc memory footprint
@@ -39,9 +89,36 @@ int main(int argc, char* argv[])
     LOG_INFO("Chunks: %u", terrain.chunkPool.size);
 
     glfwSetKeyCallback(glfwGetCurrentContext(), key_callback);
+    graphics_logRenderSettings(&settings);
 
-    camPos = (vec3) {terrain.width / 2, terrain.height / 2, 10};
-    forward = normalize(((vec3) {0, -2, 3}));
+    resetCamera(terrain.width, terrain.height);
+
+    if (options.benchTrace)
+    {
+        graphics_benchmarkTraversal(&terrain, camPos, forward, &settings, 20);
+        terrain_destroy(&terrain);
+        graphics_destroy();
+        return 0;
+    }
+
+    if (options.capture)
+    {
+        bool captured = tiledCapture_capture(&terrain, camPos, forward, &settings, options.imageSize, options.outputPath);
+        terrain_destroy(&terrain);
+        graphics_destroy();
+        return captured ? 0 : -1;
+    }
+
+    if (options.servePath != NULL)
+    {
+        bool served = renderServer_run(&terrain, options.servePath, &settings);
+        terrain_destroy(&terrain);
+        graphics_destroy();
+        return served ? 0 : -1;
+    }
+
+    if (options.recordPath != NULL)
+        frameRecorder_start(options.recordPath, graphics_getRes());
 
     u32 time = uclock();
     u32 frameTime = 1;
@@ -53,7 +130,13 @@ int main(int argc, char* argv[])
 
         updateCamera(frameTime / 1000000.0f);
 
-        graphics_drawFrame(&terrain, camPos, forward);
+        graphics_drawFrame(&terrain, camPos, forward, &settings);
+
+        if (captureRequested)
+        {
+            tiledCapture_capture(&terrain, camPos, forward, &settings, options.imageSize, options.outputPath);
+            captureRequested = false;
+        }
 
         // frame time
         frameTime = uclock() - time;
@@ -69,6 +152,7 @@ int main(int argc, char* argv[])
     }
 
     // clean up
+    frameRecorder_stop();
     terrain_destroy(&terrain);
     graphics_destroy();
 
@@ -80,16 +164,101 @@ int main(int argc, char* argv[])
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+    if (action != GLFW_PRESS)
+        return;
+
+    RenderSettings old = settings;
+
+    if (key == GLFW_KEY_F1)
+        settings.stats = !settings.stats;
+
+    if (key == GLFW_KEY_F2)
+        settings.heatmap = !settings.heatmap;
+
+    // cycles the resolution scale through 1, 0.75, 0.5 and 0.25
+    if (key == GLFW_KEY_F3)
+        settings.resolutionScale = settings.resolutionScale <= 0.25f ? 1.0f : settings.resolutionScale - 0.25f;
+
+    // cycles through the tuned size and common workgroup shapes
+    if (key == GLFW_KEY_F4)
+    {
+        static const uvec2 sizes[] = {{0, 0}, {8, 8}, {16, 8}, {32, 4}, {64, 1}, {16, 16}};
+        static u32 sizeIdx = 0;
+        sizeIdx = (sizeIdx + 1) % (sizeof(sizes) / sizeof(sizes[0]));
+        settings.workGroupSize = sizes[sizeIdx];
+    }
+
+    if (key == GLFW_KEY_F5)
         graphics_reloadShaders();
 
-    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+    if (key == GLFW_KEY_F6)
+        settings.dfMode = (settings.dfMode + 1) % DF_MODE_COUNT;
+
+    if (key == GLFW_KEY_F7)
+        settings.octantDF = !settings.octantDF;
+
+    if (key == GLFW_KEY_F8)
+        settings.parallelDFBuild = !settings.parallelDFBuild;
+
+    if (key == GLFW_KEY_F9)
+        settings.slicedDFBuild = !settings.slicedDFBuild;
+
+    // the cache may have been forced on by the renderer
+    if (key == GLFW_KEY_F10)
+        settings.chunkCache = !chunkCache_isEnabled();
+
+    // cycles the LOD bias through off, 1, 2 and 4 pixels per mip cell
+    if (key == GLFW_KEY_F11)
+        settings.lodBias = settings.lodBias == 0 ? 1.0f : (settings.lodBias >= 4 ? 0.0f : settings.lodBias * 2);
+
+    if (key == GLFW_KEY_F12)
+        settings.upsample = !settings.upsample;
+
+    if (key == GLFW_KEY_R)
+        settings.reprojection = !settings.reprojection;
+
+    if (key == GLFW_KEY_C)
+        settings.conePrepass = !settings.conePrepass;
+
+    if (key == GLFW_KEY_B)
+        settings.rasterPrepass = !settings.rasterPrepass;
+
+    if (key == GLFW_KEY_G)
+        settings.deferredShading = !settings.deferredShading;
+
+    if (key == GLFW_KEY_L)
+        settings.cooperativeTraversal = !settings.cooperativeTraversal;
+
+    if (key == GLFW_KEY_T)
+        settings.persistentThreads = !settings.persistentThreads;
+
+    if (key == GLFW_KEY_V)
+        settings.checkerboard = !settings.checkerboard;
+
+    // cycles the full rate area of the checkerboard through off, the inner circle and a smaller one
+    if (key == GLFW_KEY_P)
+        settings.peripheryRadius = settings.peripheryRadius == 0 ? 1.0f : (settings.peripheryRadius > 0.5f ? 0.5f : 0.0f);
+
+    if (memcmp(&old, &settings, sizeof(RenderSettings)) != 0)
+        graphics_logRenderSettings(&settings);
+
+    if (key == GLFW_KEY_K)
+        captureRequested = true;
+
+    if (key == GLFW_KEY_SPACE)
         camPos.y += 2;
 
-    if (key == GLFW_KEY_LEFT_CONTROL && action == GLFW_PRESS)
+    if (key == GLFW_KEY_LEFT_CONTROL)
         camPos.y -= 2;
 }
 
+// looks over the terrain from the middle of one side
+static void resetCamera(u32 terrainWidth, u32 terrainHeight)
+{
+    camPos = (vec3) {terrainWidth / 2, terrainHeight / 2, 10};
+    forward = normalize(((vec3) {0, -2, 3}));
+}
+
 static void updateCamera(float dTimeS)
 {
     GLFWwindow* window = glfwGetCurrentContext();
@@ -143,3 +312,126 @@ static void updateCamera(float dTimeS)
     oldPosX = posX;
     oldPosY = posY;
 }
+
+static void benchmarkDistanceField(void)
+{
+    // compares the serial sweep passes with the parallel scan passes on increasingly large terrains
+    for (u32 width = 1024; width <= 8192; width *= 2)
+    {
+        Terrain terrain;
+        terrain_init(&terrain, width, TERRAIN_HEIGHT);
+        distanceField_benchmark(&terrain, 5);
+        terrain_destroy(&terrain);
+    }
+}
+
+static bool renderOnWorkers(const Options* options)
+{
+    if (options->imageSize.x == 0 || options->imageSize.y == 0)
+    {
+        LOG_ERROR("Invalid image size %ux%u", options->imageSize.x, options->imageSize.y);
+        return false;
+    }
+
+    const char* addresses[TILE_COORDINATOR_MAX_WORKERS + 1];
+    u32 workerCount = 0;
+    for (char* address = strtok(options->workers, ","); address != NULL && workerCount <= TILE_COORDINATOR_MAX_WORKERS; address = strtok(NULL, ","))
+        addresses[workerCount++] = address;
+
+    // the workers generate their terrain with the same width, so the default camera is the same as theirs
+    resetCamera(options->width, TERRAIN_HEIGHT);
+    return tileCoordinator_render(addresses, workerCount, options->imageSize, camPos, forward, options->outputPath);
+}
+
+static bool parseArgs(int argc, char* argv[], Options* options)
+{
+    // a bare number is the terrain width, all other arguments override the default render settings
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--bench-df") == 0)
+            options->benchDF = true;
+        else if (strcmp(arg, "--bench-trace") == 0)
+            options->benchTrace = true;
+        else if (strcmp(arg, "--serve") == 0 && value)
+            options->servePath = argv[++i];
+        else if (strcmp(arg, "--workers") == 0 && value)
+            options->workers = argv[++i];
+        else if (strcmp(arg, "--record") == 0 && value)
+            options->recordPath = argv[++i];
+        else if (strcmp(arg, "--capture") == 0)
+            options->capture = true;
+        else if (strcmp(arg, "--image-size") == 0 && value)
+            sscanf(argv[++i], "%ux%u", &options->imageSize.x, &options->imageSize.y);
+        else if (strcmp(arg, "--output") == 0 && value)
+            options->outputPath = argv[++i];
+        else if (strcmp(arg, "--cooperative") == 0)
+            settings.cooperativeTraversal = true;
+        else if (strcmp(arg, "--persistent") == 0)
+            settings.persistentThreads = true;
+        else if (strcmp(arg, "--persistent-groups") == 0 && value)
+        {
+            settings.persistentThreads = true;
+            settings.persistentGroupCount = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(arg, "--stats") == 0)
+            settings.stats = true;
+        else if (strcmp(arg, "--heatmap") == 0)
+            settings.heatmap = true;
+        else if (strcmp(arg, "--no-upsample") == 0)
+            settings.upsample = false;
+        else if (strcmp(arg, "--no-reprojection") == 0)
+            settings.reprojection = false;
+        else if (strcmp(arg, "--no-cone-prepass") == 0)
+            settings.conePrepass = false;
+        else if (strcmp(arg, "--raster-prepass") == 0)
+            settings.rasterPrepass = true;
+        else if (strcmp(arg, "--deferred") == 0)
+            settings.deferredShading = true;
+        else if (strcmp(arg, "--fog") == 0 && value)
+        {
+            // fog is part of the shading pass
+            settings.deferredShading = true;
+            settings.fogDistance = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(arg, "--checkerboard") == 0)
+            settings.checkerboard = true;
+        else if (strcmp(arg, "--periphery") == 0 && value)
+            settings.peripheryRadius = strtof(argv[++i], NULL);
+        else if (strcmp(arg, "--octant-df") == 0)
+            settings.octantDF = true;
+        else if (strcmp(arg, "--parallel-df") == 0)
+            settings.parallelDFBuild = true;
+        else if (strcmp(arg, "--sliced-df") == 0)
+            settings.slicedDFBuild = true;
+        else if (strcmp(arg, "--chunk-cache") == 0)
+            settings.chunkCache = true;
+        else if (strcmp(arg, "--df") == 0 && value && (strcmp(value, "manhattan") == 0 || strcmp(value, "euclidean") == 0))
+            settings.dfMode = strcmp(argv[++i], "euclidean") == 0 ? DF_MODE_EUCLIDEAN : DF_MODE_MANHATTAN;
+        else if (strcmp(arg, "--res-scale") == 0 && value)
+            settings.resolutionScale = strtof(argv[++i], NULL);
+        else if (strcmp(arg, "--lod") == 0 && value)
+            settings.lodBias = strtof(argv[++i], NULL);
+        else if (strcmp(arg, "--workgroup") == 0 && value)
+        {
+            // "auto" (or any other non size) leaves it to the tuner
+            settings.workGroupSize = (uvec2) {0, 0};
+            sscanf(argv[++i], "%ux%u", &settings.workGroupSize.x, &settings.workGroupSize.y);
+        }
+        else if (arg[0] >= '0' && arg[0] <= '9')
+            options->width = atoi(arg);
+        else
+        {
+            LOG_ERROR("Unknown argument: %s", arg);
+            LOG_INFO("Usage: %s [width] [--bench-df] [--bench-trace] [--serve address] [--workers address,...] [--capture] [--image-size WxH] [--output file.ppm] "
+                     "[--record file] [--res-scale f] [--no-upsample] [--no-reprojection] [--no-cone-prepass] [--raster-prepass] "
+                     "[--deferred] [--fog f] [--checkerboard] [--periphery f] [--df manhattan|euclidean] [--octant-df] [--parallel-df] "
+                     "[--sliced-df] [--chunk-cache] [--lod f] [--workgroup XxY|auto] [--cooperative] [--persistent] [--persistent-groups n] [--stats] [--heatmap]", argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ppm_writer.h"
+#include "cplog.h"
+
+static bool seekFile(FILE* file, u64 offset);
+
+bool ppmWriter_open(PpmWriter* writer, const char* path, uvec2 size)
+{
+    *writer = (PpmWriter) {.size = size};
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        LOG_ERROR("Could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    int headerSize = fprintf(writer->file, "P6\n%u %u\n255\n", size.x, size.y);
+    writer->dataStart = headerSize > 0 ? (u64) headerSize : 0;
+    writer->failed = headerSize <= 0;
+    return true;
+}
+
+void ppmWriter_writeRect(PpmWriter* writer, uvec2 topLeft, uvec2 size, const u8* rgba, bool bottomUp)
+{
+    if (writer->failed)
+        return;
+
+    if (size.x > writer->rowCapacity)
+    {
+        free(writer->row);
+        writer->row = malloc((u64) size.x * 3);
+        if (writer->row == NULL)
+            PANIC("Could not allocate a row of %u pixels", size.x);
+        writer->rowCapacity = size.x;
+    }
+
+    // the parts of the image are written in any order, seeking past the end of the file leaves a gap that is filled later
+    for (u32 y = 0; y < size.y && !writer->failed; y++)
+    {
+        const u8* src = rgba + (u64) (bottomUp ? size.y - 1 - y : y) * size.x * 4;
+        for (u32 x = 0; x < size.x; x++)
+            memcpy(writer->row + x * 3, src + x * 4, 3);
+
+        u64 offset = writer->dataStart + ((u64) (topLeft.y + y) * writer->size.x + topLeft.x) * 3;
+        writer->failed = !seekFile(writer->file, offset) || fwrite(writer->row, 3, size.x, writer->file) != size.x;
+    }
+}
+
+bool ppmWriter_close(PpmWriter* writer)
+{
+    bool success = !writer->failed;
+    if (writer->file != NULL)
+        success &= fclose(writer->file) == 0;
+    free(writer->row);
+
+    *writer = (PpmWriter) {0};
+    return success;
+}
+
+// images of more than 2GB need 64 bit offsets, which long only has outside of Windows
+static bool seekFile(FILE* file, u64 offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (__int64) offset, SEEK_SET) == 0;
+#else
+    return fseek(file, (long) offset, SEEK_SET) == 0;
+#endif
+}
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include "raster_prepass.h"
+#include "distance_field.h"
+#include "cplog.h"
+#include "glad/glad.h"
+
+// boxes are merged to the next level (2x2x2 boxes) until at most this many are on the surface of the filled volume
+static const u32 MAX_RASTER_BOXES = 1u << 18;
+
+// a box of level n covers 2^n chunks per axis, level 1 are the superchunks
+static const u32 MIN_BOX_LEVEL = 1;
+static const u32 MAX_BOX_LEVEL = 6;
+
+// the camera has to be at least this many blocks away from every box (the near plane and the safety margin of the distances)
+static const float CAMERA_MARGIN = 1.0f;
+
+static void buildBoxes(const Terrain* terrain);
+static void downsampleGrid(void);
+static u32 countSurfaceBoxes(u32* boxes);
+static bool isOccupied(i32 x, i32 y, i32 z);
+static bool isCameraInsideBox(vec3 camPos);
+
+// same layout as in terrain.c, but in chunk coordinates
+static INLINE u32 getChunkIdx(u32 x, u32 y, u32 z, u32 width, u32 height)
+{
+    u32 superChunkIdx = (((x >> 1) * (width >> 4) + (z >> 1)) * (height >> 4) + (y >> 1));
+    u32 withinSuperChunkIdx = (((x & 1u) << 2) + ((z & 1u) << 1) + (y & 1u));
+    return (superChunkIdx << 3) + withinSuperChunkIdx;
+}
+
+// ##### STATE ####
+
+static u32 shaderChunkBounds;
+static u32 emptyVAO;
+static u32 boxSSBO;
+static u32 framebuffer;
+
+static u32 boxCount = 0;
+static bool boxesOutdated = true;
+
+// which boxes of the current level contain any non empty chunk, kept for the camera check
+static u8* grid;
+static u32 gridX;
+static u32 gridY;
+static u32 gridZ;
+static u32 gridLevel;
+
+// ################
+
+void rasterPrepass_init(void)
+{
+    glCreateVertexArrays(1, &emptyVAO);
+    glCreateBuffers(1, &boxSSBO);
+    glCreateFramebuffers(1, &framebuffer);
+}
+
+void rasterPrepass_destroy(void)
+{
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteBuffers(1, &boxSSBO);
+    glDeleteFramebuffers(1, &framebuffer);
+
+    free(grid);
+    grid = NULL;
+    boxCount = 0;
+    boxesOutdated = true;
+}
+
+void rasterPrepass_loadShaders(void)
+{
+    shaderChunkBounds = gllib_makePipeline("res/shaders/raster/chunkBounds.vert", "res/shaders/raster/chunkBounds.frag");
+}
+
+void rasterPrepass_freeShaders(void)
+{
+    glDeleteProgram(shaderChunkBounds);
+}
+
+void rasterPrepass_invalidate(void)
+{
+    boxesOutdated = true;
+}
+
+bool rasterPrepass_draw(const Terrain* terrain, const Texture* target, u32 width, u32 height, vec3 camPos, mat4 viewProjMat)
+{
+    // a running DF build keeps the previous top level array in use, the boxes have to match that one
+    if (boxesOutdated)
+    {
+        if (distanceField_isRebuilding())
+            return false;
+
+        buildBoxes(terrain);
+        boxesOutdated = false;
+    }
+
+    if (isCameraInsideBox(camPos))
+        return false;
+
+    glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, target->handle, 0);
+    const float noBox[4] = {RASTER_PREPASS_NO_BOX, 0, 0, 0};
+    glClearNamedFramebufferfv(framebuffer, GL_COLOR, 0, noBox);
+
+    if (boxCount == 0)
+        return true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+
+    // every pixel keeps the closest surface, the depth buffer isn't needed for that
+    // depth clamping disables the far plane, which would cut off large worlds
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_MIN);
+    glEnable(GL_DEPTH_CLAMP);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    glUseProgram(shaderChunkBounds);
+    glBindVertexArray(emptyVAO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, boxSSBO);
+
+    glUniformMatrix4fv(glGetUniformLocation(shaderChunkBounds, "viewProjMat"), 1, GL_FALSE, viewProjMat.arr);
+    glUniform3f(glGetUniformLocation(shaderChunkBounds, "camPos"), camPos.x, camPos.y, camPos.z);
+    glUniform1f(glGetUniformLocation(shaderChunkBounds, "boxSize"), (float) (8u << gridLevel));
+
+    // the 36 vertices of every box are generated in the vertex shader
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, boxCount);
+
+    glDisable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glDisable(GL_DEPTH_CLAMP);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    return true;
+}
+
+static void buildBoxes(const Terrain* terrain)
+{
+    u32 chunksX = terrain->width / 8;
+    u32 chunksY = terrain->height / 8;
+
+    gridLevel = MIN_BOX_LEVEL;
+    gridX = (chunksX + (1u << gridLevel) - 1) >> gridLevel;
+    gridY = (chunksY + (1u << gridLevel) - 1) >> gridLevel;
+    gridZ = gridX;
+
+    free(grid);
+    grid = calloc((u64) gridX * gridY * gridZ, 1);
+    if (grid == NULL)
+        PANIC("Could not allocate the chunk bounds grid");
+
+    for (u32 x = 0; x < chunksX; x++)
+        for (u32 z = 0; z < chunksX; z++)
+            for (u32 y = 0; y < chunksY; y++)
+                if (terrain->topLevelArray[getChunkIdx(x, y, z, terrain->width, terrain->height)] >> 30 != 0)
+                    grid[((u64) (x >> gridLevel) * gridZ + (z >> gridLevel)) * gridY + (y >> gridLevel)] = 1;
+
+    while (gridLevel < MAX_BOX_LEVEL && countSurfaceBoxes(NULL) > MAX_RASTER_BOXES)
+        downsampleGrid();
+
+    boxCount = countSurfaceBoxes(NULL);
+    u32* boxes = malloc(max(boxCount, 1u) * sizeof(u32));
+    if (boxes == NULL)
+        PANIC("Could not allocate the chunk bounds");
+
+    countSurfaceBoxes(boxes);
+    glNamedBufferData(boxSSBO, max(boxCount, 1u) * sizeof(u32), boxes, GL_STATIC_DRAW);
+    free(boxes);
+
+    LOG_INFO("Chunk bounds: %u boxes of %u blocks", boxCount, 8u << gridLevel);
+}
+
+static void downsampleGrid(void)
+{
+    u32 newX = (gridX + 1) >> 1;
+    u32 newY = (gridY + 1) >> 1;
+    u32 newZ = newX;
+
+    u8* newGrid = calloc((u64) newX * newY * newZ, 1);
+    if (newGrid == NULL)
+        PANIC("Could not allocate the chunk bounds grid");
+
+    for (u32 x = 0; x < gridX; x++)
+        for (u32 z = 0; z < gridZ; z++)
+            for (u32 y = 0; y < gridY; y++)
+                if (grid[((u64) x * gridZ + z) * gridY + y])
+                    newGrid[((u64) (x >> 1) * newZ + (z >> 1)) * newY + (y >> 1)] = 1;
+
+    free(grid);
+    grid = newGrid;
+    gridX = newX;
+    gridY = newY;
+    gridZ = newZ;
+    gridLevel++;
+}
+
+// boxes with all 6 neighbours filled can't be the first one a ray enters, so only the others are counted (and written, if boxes isn't NULL)
+// every box is packed as x (11 bits), y (10 bits), z (11 bits) in units of boxes
+static u32 countSurfaceBoxes(u32* boxes)
+{
+    u32 count = 0;
+    for (i32 x = 0; x < (i32) gridX; x++)
+        for (i32 z = 0; z < (i32) gridZ; z++)
+            for (i32 y = 0; y < (i32) gridY; y++)
+            {
+                if (!isOccupied(x, y, z))
+                    continue;
+
+                if (isOccupied(x - 1, y, z) && isOccupied(x + 1, y, z) && isOccupied(x, y - 1, z)
+                    && isOccupied(x, y + 1, z) && isOccupied(x, y, z - 1) && isOccupied(x, y, z + 1))
+                    continue;
+
+                if (boxes != NULL)
+                    boxes[count] = (u32) x | (u32) y << 11 | (u32) z << 21;
+                count++;
+            }
+
+    return count;
+}
+
+// everything outside of the volume is empty
+static bool isOccupied(i32 x, i32 y, i32 z)
+{
+    if (x < 0 || y < 0 || z < 0 || x >= (i32) gridX || y >= (i32) gridY || z >= (i32) gridZ)
+        return false;
+
+    return grid[((u64) x * gridZ + z) * gridY + y] != 0;
+}
+
+static bool isCameraInsideBox(vec3 camPos)
+{
+    // the corners of a cube around the camera, a box is at least as large as that cube
+    float boxSize = (float) (8u << gridLevel);
+    for (u32 i = 0; i < 8; i++)
+    {
+        float x = camPos.x + (i & 1 ? CAMERA_MARGIN : -CAMERA_MARGIN);
+        float y = camPos.y + (i & 2 ? CAMERA_MARGIN : -CAMERA_MARGIN);
+        float z = camPos.z + (i & 4 ? CAMERA_MARGIN : -CAMERA_MARGIN);
+        if (x >= 0 && y >= 0 && z >= 0 && isOccupied((i32) (x / boxSize), (i32) (y / boxSize), (i32) (z / boxSize)))
+            return true;
+    }
+
+    return false;
+}
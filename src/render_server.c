@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render_server.h"
+#include "cplog.h"
+
+#ifdef _WIN32
+
+bool renderServer_run(Terrain* terrain, const char* address, const RenderSettings* settings)
+{
+    LOG_ERROR("The render server needs POSIX sockets, which aren't supported on this platform");
+    return false;
+}
+
+#else
+
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "GLFW/glfw3.h"
+#include "cptime.h"
+#include "socket_address.h"
+
+#define MAX_CLIENTS 32
+#define MAX_BATCH_JOBS 64
+#define MAX_JOB_LINE 256
+#define MAX_IMAGE_SIZE 8192
+
+// jobs are collected for at most this long after the first one arrived, then they are traced together
+static const u64 BATCH_WINDOW_US = 5000;
+
+typedef enum ImageFormat
+{
+    IMAGE_FORMAT_RAW,
+    IMAGE_FORMAT_PPM
+} ImageFormat;
+
+typedef struct Client
+{
+    int fd;
+    char line[MAX_JOB_LINE];
+    u32 lineLength;
+} Client;
+
+typedef struct RenderJob
+{
+    int fd;
+    RenderView view;
+    ImageFormat format;
+} RenderJob;
+
+static void acceptClients(void);
+static void readClient(u32 clientIdx);
+static void closeClient(u32 clientIdx);
+static void parseJob(int fd, char* line);
+static void renderBatch(void);
+static void sendImage(const RenderJob* job, const ViewRegion* region);
+static void sendError(int fd, const char* message);
+static bool sendAll(int fd, const void* data, u64 size);
+static void handleSignal(int signalNumber);
+
+// ##### STATE ####
+
+static int listenFd = -1;
+
+static Client clients[MAX_CLIENTS];
+static u32 clientCount = 0;
+
+static Terrain* serverTerrain;
+static const RenderSettings* serverSettings;
+
+static RenderJob jobs[MAX_BATCH_JOBS];
+static u32 jobCount = 0;
+static u64 firstJobTime = 0;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+// ################
+
+bool renderServer_run(Terrain* terrain, const char* address, const RenderSettings* settings)
+{
+    listenFd = socketAddress_listen(address, MAX_CLIENTS);
+    if (listenFd < 0)
+        return false;
+
+    serverTerrain = terrain;
+    serverSettings = settings;
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    // clients that disconnect before their answer arrived must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+
+    LOG_INFO("Serving render jobs on %s", address);
+
+    while (!stopRequested && !glfwWindowShouldClose(glfwGetCurrentContext()))
+    {
+        glfwPollEvents();
+
+        struct pollfd fds[MAX_CLIENTS + 1];
+        fds[0] = (struct pollfd) {listenFd, POLLIN, 0};
+        for (u32 i = 0; i < clientCount; i++)
+            fds[i + 1] = (struct pollfd) {clients[i].fd, POLLIN, 0};
+
+        // while a batch is being collected, wake up in time to trace it
+        u32 polledClients = clientCount;
+        poll(fds, polledClients + 1, jobCount > 0 ? 1 : 50);
+
+        // backwards, since closing a client moves the last one into its place
+        for (u32 i = polledClients; i > 0; i--)
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                readClient(i - 1);
+
+        if (fds[0].revents & POLLIN)
+            acceptClients();
+
+        if (jobCount > 0 && uclock() - firstJobTime >= BATCH_WINDOW_US)
+            renderBatch();
+    }
+
+    while (clientCount > 0)
+        closeClient(clientCount - 1);
+
+    close(listenFd);
+    socketAddress_release(address);
+    LOG_INFO("Render server stopped");
+
+    return true;
+}
+
+static void acceptClients(void)
+{
+    int fd;
+    while ((fd = accept(listenFd, NULL, NULL)) >= 0)
+    {
+        if (clientCount == MAX_CLIENTS)
+        {
+            sendError(fd, "too many connections");
+            close(fd);
+            continue;
+        }
+
+        clients[clientCount++] = (Client) {.fd = fd};
+    }
+}
+
+static void readClient(u32 clientIdx)
+{
+    Client* client = &clients[clientIdx];
+
+    char buffer[4096];
+    ssize_t count = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (count <= 0)
+    {
+        closeClient(clientIdx);
+        return;
+    }
+
+    for (ssize_t i = 0; i < count; i++)
+    {
+        if (buffer[i] != '\n')
+        {
+            // overlong lines are cut off, which makes them invalid
+            if (client->lineLength < MAX_JOB_LINE - 1)
+                client->line[client->lineLength++] = buffer[i];
+            continue;
+        }
+
+        client->line[client->lineLength] = '\0';
+        client->lineLength = 0;
+        parseJob(client->fd, client->line);
+    }
+}
+
+static void closeClient(u32 clientIdx)
+{
+    int fd = clients[clientIdx].fd;
+
+    // nobody is waiting for the jobs of this client anymore
+    u32 remaining = 0;
+    for (u32 i = 0; i < jobCount; i++)
+        if (jobs[i].fd != fd)
+            jobs[remaining++] = jobs[i];
+    jobCount = remaining;
+
+    close(fd);
+    clients[clientIdx] = clients[--clientCount];
+}
+
+static void parseJob(int fd, char* line)
+{
+    line[strcspn(line, "\r")] = '\0';
+    if (line[0] == '\0')
+        return;
+
+    uvec2 size;
+    vec3 camPos;
+    vec3 forward;
+    int consumed = 0;
+    if (sscanf(line, "RENDER %u %u %f %f %f %f %f %f%n", &size.x, &size.y, &camPos.x, &camPos.y, &camPos.z,
+               &forward.x, &forward.y, &forward.z, &consumed) != 8 || consumed == 0)
+    {
+        sendError(fd, "expected RENDER <width> <height> <camX> <camY> <camZ> <forwardX> <forwardY> <forwardZ> [fov] [raw|ppm] [crop ...]");
+        return;
+    }
+
+    RenderJob job = {.fd = fd, .format = IMAGE_FORMAT_RAW};
+    float fov = 0;
+    uvec2 fullSize = {0, 0};
+    uvec2 cropTopLeft = {0, 0};
+    for (char* token = strtok(line + consumed, " \t"); token != NULL; token = strtok(NULL, " \t"))
+    {
+        char* end;
+        float value = strtof(token, &end);
+        if (strcmp(token, "raw") == 0)
+            job.format = IMAGE_FORMAT_RAW;
+        else if (strcmp(token, "ppm") == 0)
+            job.format = IMAGE_FORMAT_PPM;
+        else if (strcmp(token, "crop") == 0)
+        {
+            u32 crop[4];
+            for (u32 i = 0; i < 4; i++)
+            {
+                char* number = strtok(NULL, " \t");
+                if (number == NULL || sscanf(number, "%u", &crop[i]) != 1)
+                {
+                    sendError(fd, "expected crop <full width> <full height> <left> <top>");
+                    return;
+                }
+            }
+            fullSize = (uvec2) {crop[0], crop[1]};
+            cropTopLeft = (uvec2) {crop[2], crop[3]};
+        }
+        else if (*end == '\0' && value > 0 && value < 180)
+            fov = value;
+        else
+        {
+            sendError(fd, "unknown option, expected a field of view, raw|ppm or crop");
+            return;
+        }
+    }
+
+    if (size.x == 0 || size.y == 0 || size.x > MAX_IMAGE_SIZE || size.y > MAX_IMAGE_SIZE)
+    {
+        sendError(fd, "the image size has to be between 1 and 8192");
+        return;
+    }
+
+    if (fullSize.x != 0 && ((u64) cropTopLeft.x + size.x > fullSize.x || (u64) cropTopLeft.y + size.y > fullSize.y))
+    {
+        sendError(fd, "the cropped part has to lie within the full image");
+        return;
+    }
+
+    if (forward.x == 0 && forward.y == 0 && forward.z == 0)
+    {
+        sendError(fd, "the forward vector must not be zero");
+        return;
+    }
+
+    job.view = (RenderView) {camPos, normalize(forward), fov, size};
+    if (fullSize.x != 0)
+    {
+        // the tracer counts rows from the bottom
+        job.view.fullSize = fullSize;
+        job.view.cropOffset = (uvec2) {cropTopLeft.x, fullSize.y - cropTopLeft.y - size.y};
+    }
+
+    if (jobCount == MAX_BATCH_JOBS)
+        renderBatch();
+
+    if (jobCount == 0)
+        firstJobTime = uclock();
+    jobs[jobCount++] = job;
+}
+
+static void renderBatch(void)
+{
+    RenderView views[MAX_BATCH_JOBS];
+    ViewRegion regions[MAX_BATCH_JOBS];
+    for (u32 i = 0; i < jobCount; i++)
+        views[i] = jobs[i].view;
+
+    if (graphics_drawViews(serverTerrain, views, jobCount, serverSettings, regions))
+    {
+        for (u32 i = 0; i < jobCount; i++)
+            sendImage(&jobs[i], &regions[i]);
+    }
+    else
+    {
+        // batches that don't fit into one atlas are traced job by job
+        for (u32 i = 0; i < jobCount; i++)
+        {
+            if (graphics_drawViews(serverTerrain, &views[i], 1, serverSettings, &regions[i]))
+                sendImage(&jobs[i], &regions[i]);
+            else
+                sendError(jobs[i].fd, "the image exceeds the maximum texture size");
+        }
+    }
+
+    jobCount = 0;
+}
+
+static void sendImage(const RenderJob* job, const ViewRegion* region)
+{
+    u32 width = region->size.x;
+    u32 height = region->size.y;
+
+    u8* pixels = malloc((u64) width * height * 4);
+    if (pixels == NULL)
+    {
+        sendError(job->fd, "out of memory");
+        return;
+    }
+    graphics_readView(region, pixels);
+
+    char ppmHeader[32] = "";
+    if (job->format == IMAGE_FORMAT_PPM)
+        snprintf(ppmHeader, sizeof(ppmHeader), "P6\n%u %u\n255\n", width, height);
+
+    u32 channels = job->format == IMAGE_FORMAT_PPM ? 3 : 4;
+    u64 headerSize = strlen(ppmHeader);
+    u64 byteCount = headerSize + (u64) width * height * channels;
+    u8* image = malloc(byteCount);
+    if (image == NULL)
+    {
+        free(pixels);
+        sendError(job->fd, "out of memory");
+        return;
+    }
+
+    // the rows of GL images start at the bottom
+    memcpy(image, ppmHeader, headerSize);
+    u8* dst = image + headerSize;
+    for (u32 y = 0; y < height; y++)
+    {
+        const u8* src = pixels + (u64) (height - 1 - y) * width * 4;
+        if (channels == 4)
+        {
+            memcpy(dst, src, width * 4);
+        }
+        else
+        {
+            for (u32 x = 0; x < width; x++)
+                memcpy(dst + x * 3, src + x * 4, 3);
+        }
+        dst += width * channels;
+    }
+
+    char header[64];
+    snprintf(header, sizeof(header), "OK %u %u %s %llu\n", width, height, job->format == IMAGE_FORMAT_PPM ? "ppm" : "raw",
+             (unsigned long long) byteCount);
+
+    // a client that disconnected is closed on the next poll
+    if (sendAll(job->fd, header, strlen(header)))
+        sendAll(job->fd, image, byteCount);
+
+    free(image);
+    free(pixels);
+}
+
+static void sendError(int fd, const char* message)
+{
+    char line[MAX_JOB_LINE];
+    snprintf(line, sizeof(line), "ERR %s\n", message);
+    sendAll(fd, line, strlen(line));
+}
+
+static bool sendAll(int fd, const void* data, u64 size)
+{
+    const u8* bytes = data;
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+static void handleSignal(int signalNumber)
+{
+    stopRequested = 1;
+}
+
+#endif
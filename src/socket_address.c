@@ -0,0 +1,199 @@
+// getaddrinfo is POSIX, -std=c17 doesn't declare it otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include "socket_address.h"
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "cplog.h"
+
+#define MAX_HOST_LENGTH 256
+
+static bool isTcpAddress(const char* address);
+static bool resolveTcp(const char* address, bool passive, struct addrinfo** result);
+static bool makeUnixAddress(const char* address, struct sockaddr_un* unixAddress);
+
+int socketAddress_listen(const char* address, int backlog)
+{
+    int fd = -1;
+    bool success = false;
+
+    if (isTcpAddress(address))
+    {
+        struct addrinfo* infos;
+        if (!resolveTcp(address, true, &infos))
+            return -1;
+
+        for (struct addrinfo* info = infos; info != NULL && !success; info = info->ai_next)
+        {
+            fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+            if (fd < 0)
+                continue;
+
+            // a restarted server can take over the port right away
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            success = bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, backlog) == 0;
+            if (!success)
+                close(fd);
+        }
+        freeaddrinfo(infos);
+    }
+    else
+    {
+        struct sockaddr_un unixAddress;
+        if (!makeUnixAddress(address, &unixAddress))
+            return -1;
+
+        // the socket file of a previous run would make binding fail
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        success = fd >= 0 && bind(fd, (struct sockaddr*) &unixAddress, sizeof(unixAddress)) == 0 && listen(fd, backlog) == 0;
+        if (!success && fd >= 0)
+            close(fd);
+    }
+
+    if (!success)
+    {
+        LOG_ERROR("Could not listen on %s: %s", address, strerror(errno));
+        return -1;
+    }
+
+    // accepted connections stay blocking, only waiting for new ones must not block
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int socketAddress_connect(const char* address)
+{
+    if (!isTcpAddress(address))
+    {
+        struct sockaddr_un unixAddress;
+        if (!makeUnixAddress(address, &unixAddress))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+
+        if (connect(fd, (struct sockaddr*) &unixAddress, sizeof(unixAddress)) != 0)
+        {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo* infos;
+    if (!resolveTcp(address, false, &infos))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    int error = ECONNREFUSED;
+    for (struct addrinfo* info = infos; info != NULL && fd < 0; info = info->ai_next)
+    {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0)
+        {
+            error = errno;
+            continue;
+        }
+
+        if (connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+        {
+            error = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(infos);
+
+    if (fd < 0)
+    {
+        errno = error;
+        return -1;
+    }
+
+    // jobs and their answers are single lines, they shouldn't wait for more data to fill a packet
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return fd;
+}
+
+void socketAddress_release(const char* address)
+{
+    if (!isTcpAddress(address))
+        unlink(address);
+}
+
+// a colon without a slash means host:port, so ./host:7000 is still a socket path
+static bool isTcpAddress(const char* address)
+{
+    return strchr(address, ':') != NULL && strchr(address, '/') == NULL;
+}
+
+static bool resolveTcp(const char* address, bool passive, struct addrinfo** result)
+{
+    const char* colon = strrchr(address, ':');
+    u32 hostLength = (u32) (colon - address);
+    if (hostLength >= MAX_HOST_LENGTH || colon[1] == '\0')
+    {
+        LOG_ERROR("%s isn't a valid <host>:<port> address", address);
+        return false;
+    }
+
+    char host[MAX_HOST_LENGTH];
+    memcpy(host, address, hostLength);
+    host[hostLength] = '\0';
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    int status = getaddrinfo(hostLength > 0 ? host : NULL, colon + 1, &hints, result);
+    if (status != 0)
+    {
+        LOG_ERROR("Could not resolve %s: %s", address, gai_strerror(status));
+        return false;
+    }
+
+    return true;
+}
+
+static bool makeUnixAddress(const char* address, struct sockaddr_un* unixAddress)
+{
+    memset(unixAddress, 0, sizeof(*unixAddress));
+    unixAddress->sun_family = AF_UNIX;
+    if (strlen(address) >= sizeof(unixAddress->sun_path))
+    {
+        LOG_ERROR("The socket path %s is too long", address);
+        return false;
+    }
+
+    strcpy(unixAddress->sun_path, address);
+    return true;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include "FastNoiseLite.h"
 
 static void generate(Terrain* terrain);
+static u8 majorityBlock(const u8* blocks, u32 count);
 
 void terrain_init(Terrain* terrain, u32 width, u32 height)
 {
@@ -33,6 +34,8 @@ void terrain_init(Terrain* terrain, u32 width, u32 height)
     poolAllocatorCreate(&terrain->chunkBitmaskPool, initialPoolSize, 64, NULL);
 
     terrain->dirty = true;
+    terrain->dirtyPoolBegin = 0xFFFFFFFFu;
+    terrain->dirtyPoolEnd = 0;
 
     generate(terrain);
 }
@@ -64,6 +67,12 @@ static INLINE void setBit(u32* memory, u32 idx, bool value)
     *memory |= mask;
 }
 
+static INLINE void markPoolDirty(Terrain* terrain, u32 poolIdx)
+{
+    terrain->dirtyPoolBegin = min(terrain->dirtyPoolBegin, poolIdx);
+    terrain->dirtyPoolEnd = max(terrain->dirtyPoolEnd, poolIdx + 1);
+}
+
 static INLINE u8 packColor(u8 r, u8 g, u8 b)
 {
     r = r >> 5;
@@ -115,6 +124,7 @@ void terrain_setBlock(Terrain* terrain, u32 x, u32 y, u32 z, u8 value)
         // update bitmask
         u32* bitmaskData = poolAllocatorGet(&terrain->chunkBitmaskPool, chunkVal);
         setBit(&bitmaskData[withinChunkIdx / 32], withinChunkIdx % 32, value);
+        markPoolDirty(terrain, chunkVal);
 
         // check if chunk is now uniform and can be deallocated / simplified
         if (memcmp(chunkData, chunkData + 1, 511) == 0)
@@ -143,6 +153,7 @@ void terrain_setBlock(Terrain* terrain, u32 x, u32 y, u32 z, u8 value)
         u32* bitmaskData = poolAllocatorGet(&terrain->chunkBitmaskPool, newChunkIdx);
         memset(chunkData, chunkVal == 0 ? 0 : 0xFF, 64);
         setBit(&bitmaskData[withinChunkIdx / 32], withinChunkIdx % 32, value);
+        markPoolDirty(terrain, newChunkIdx);
     }
 
     terrain->dirty = true;
@@ -179,6 +190,64 @@ u8 terrain_getBlock(Terrain* terrain, u32 x, u32 y, u32 z)
     return chunkData[withinChunkIdx];
 }
 
+void terrain_buildChunkMips(const Terrain* terrain, u32 poolIdx, u32* mips)
+{
+    const u8* chunkData = poolAllocatorGet(&terrain->chunkPool, poolIdx);
+    u8* level1 = (u8*) mips;
+    u8* level2 = (u8*) (mips + 16);
+    u32* occupancy = mips + 18;
+
+    memset(mips, 0, CHUNK_MIP_WORDS * sizeof(u32));
+
+    for (u32 x = 0; x < 4; x++)
+        for (u32 z = 0; z < 4; z++)
+            for (u32 y = 0; y < 4; y++)
+            {
+                u8 blocks[8];
+                for (u32 i = 0; i < 8; i++)
+                    blocks[i] = chunkData[getWithinChunkIdx(x * 2 + (i >> 2), y * 2 + (i & 1), z * 2 + ((i >> 1) & 1))];
+
+                u32 cellIdx = x * 16 + z * 4 + y;
+                level1[cellIdx] = majorityBlock(blocks, 8);
+                if (level1[cellIdx] != 0)
+                    occupancy[cellIdx / 32] |= 1u << (cellIdx % 32);
+            }
+
+    for (u32 x = 0; x < 2; x++)
+        for (u32 z = 0; z < 2; z++)
+            for (u32 y = 0; y < 2; y++)
+            {
+                u8 cells[8];
+                for (u32 i = 0; i < 8; i++)
+                    cells[i] = level1[(x * 2 + (i >> 2)) * 16 + (z * 2 + ((i >> 1) & 1)) * 4 + y * 2 + (i & 1)];
+
+                level2[x * 4 + z * 2 + y] = majorityBlock(cells, 8);
+            }
+}
+
+static u8 majorityBlock(const u8* blocks, u32 count)
+{
+    // ties go to the block that comes first
+    u8 best = 0;
+    u32 bestCount = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        if (blocks[i] == 0 || blocks[i] == best)
+            continue;
+
+        u32 blockCount = 0;
+        for (u32 j = i; j < count; j++)
+            blockCount += blocks[j] == blocks[i];
+
+        if (blockCount > bestCount)
+        {
+            best = blocks[i];
+            bestCount = blockCount;
+        }
+    }
+    return best;
+}
+
 static void generate(Terrain* terrain)
 {
     srand(41233125);
@@ -229,6 +298,7 @@ static void generate(Terrain* terrain)
                                 poolAllocatorAlloc(&terrain->chunkBitmaskPool);
 
                                 terrain->topLevelArray[chunkIdx] = (0b10 << 30) | poolIdx;
+                                markPoolDirty(terrain, poolIdx);
 
                                 blockData = poolAllocatorGet(&terrain->chunkPool, poolIdx);
                                 bitmask = poolAllocatorGet(&terrain->chunkBitmaskPool, poolIdx);
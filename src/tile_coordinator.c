@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tile_coordinator.h"
+#include "ppm_writer.h"
+#include "cplog.h"
+
+#ifdef _WIN32
+
+bool tileCoordinator_render(const char* const* workerAddresses, u32 workerCount, uvec2 size, vec3 camPos, vec3 forward,
+                            const char* outputPath)
+{
+    LOG_ERROR("The tile coordinator needs POSIX sockets, which aren't supported on this platform");
+    return false;
+}
+
+#else
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "cptime.h"
+#include "socket_address.h"
+
+#define MAX_REPLY_LINE 256
+#define TILE_SIZE 512
+// a worker traces its next tile while the previous one is transferred
+#define TILES_IN_FLIGHT 2
+
+// how long the workers get to generate their terrain and open their sockets
+static const u64 CONNECT_TIMEOUT_US = 120000000;
+static const int CONNECT_RETRY_MS = 100;
+
+typedef struct Tile
+{
+    uvec2 topLeft;
+    uvec2 size;
+} Tile;
+
+typedef struct Worker
+{
+    int fd;
+    const char* address;
+    // tiles sent to this worker, in the order they are answered
+    u32 pending[TILES_IN_FLIGHT];
+    u32 pendingCount;
+    u32 tilesDone;
+} Worker;
+
+static int connectWorker(const char* address);
+static void fillWorker(Worker* worker);
+static void dropWorker(Worker* worker);
+static Tile getTile(u32 tileIdx);
+static bool sendTile(Worker* worker, u32 tileIdx);
+static bool receiveTile(Worker* worker, PpmWriter* writer);
+static bool readLine(int fd, char* line, u32 maxLength);
+static bool readAll(int fd, void* data, u64 size);
+
+// ##### STATE ####
+
+static uvec2 imageSize;
+static vec3 imageCamPos;
+static vec3 imageForward;
+
+static u32 tilesX;
+static u32 tileCount;
+
+static u32 nextTile;
+// tiles of workers that dropped out, handed out again before the next new one
+static u32 retryTiles[TILE_COORDINATOR_MAX_WORKERS * TILES_IN_FLIGHT];
+static u32 retryCount;
+static u32 liveCount;
+
+// ################
+
+bool tileCoordinator_render(const char* const* workerAddresses, u32 workerCount, uvec2 size, vec3 camPos, vec3 forward,
+                            const char* outputPath)
+{
+    if (workerCount == 0 || workerCount > TILE_COORDINATOR_MAX_WORKERS)
+    {
+        LOG_ERROR("Between 1 and %u workers are supported, got %u", TILE_COORDINATOR_MAX_WORKERS, workerCount);
+        return false;
+    }
+
+    imageSize = size;
+    imageCamPos = camPos;
+    imageForward = normalize(forward);
+    tilesX = (size.x + TILE_SIZE - 1) / TILE_SIZE;
+    tileCount = tilesX * ((size.y + TILE_SIZE - 1) / TILE_SIZE);
+
+    // the tiles are written as they arrive, so the coordinator never holds the whole image
+    PpmWriter writer;
+    if (!ppmWriter_open(&writer, outputPath, size))
+        return false;
+
+    LOG_INFO("Tracing %ux%u pixels in %u tiles on %u workers", size.x, size.y, tileCount, workerCount);
+
+    // workers that can't be reached are left out, the others trace their share
+    Worker workers[TILE_COORDINATOR_MAX_WORKERS];
+    liveCount = 0;
+    for (u32 i = 0; i < workerCount; i++)
+    {
+        workers[i] = (Worker) {.fd = connectWorker(workerAddresses[i]), .address = workerAddresses[i]};
+        if (workers[i].fd >= 0)
+            liveCount++;
+    }
+
+    u64 start = uclock();
+
+    nextTile = 0;
+    retryCount = 0;
+    u32 tilesDone = 0;
+    bool success = true;
+    while (success && tilesDone < tileCount && liveCount > 0)
+    {
+        // every finished tile frees a slot for the next one, so the faster workers take more of them
+        for (u32 i = 0; i < workerCount; i++)
+            fillWorker(&workers[i]);
+
+        // workers without tiles in flight have nothing to answer, a closed connection is noticed once they get one
+        struct pollfd fds[TILE_COORDINATOR_MAX_WORKERS];
+        for (u32 i = 0; i < workerCount; i++)
+            fds[i] = (struct pollfd) {workers[i].pendingCount > 0 ? workers[i].fd : -1, POLLIN, 0};
+
+        if (poll(fds, workerCount, -1) < 0)
+        {
+            success = errno == EINTR;
+            continue;
+        }
+
+        for (u32 i = 0; i < workerCount; i++)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            if (receiveTile(&workers[i], &writer))
+                tilesDone++;
+            else
+                dropWorker(&workers[i]);
+        }
+    }
+
+    if (success && tilesDone < tileCount)
+    {
+        LOG_ERROR("No worker is left, %u of %u tiles are missing", tileCount - tilesDone, tileCount);
+        success = false;
+    }
+    else if (success)
+    {
+        LOG_INFO("Traced %u tiles in %.02fs", tileCount, (uclock() - start) / 1000000.0f);
+        for (u32 i = 0; i < workerCount; i++)
+            LOG_INFO("  %s: %u tiles", workers[i].address, workers[i].tilesDone);
+    }
+
+    for (u32 i = 0; i < workerCount; i++)
+        if (workers[i].fd >= 0)
+            close(workers[i].fd);
+
+    if (!ppmWriter_close(&writer))
+    {
+        LOG_ERROR("Could not write %s", outputPath);
+        success = false;
+    }
+    else if (success)
+    {
+        LOG_INFO("Wrote %s", outputPath);
+    }
+
+    return success;
+}
+
+static int connectWorker(const char* address)
+{
+    // the worker may still be generating its terrain
+    u64 start = uclock();
+    while (true)
+    {
+        int fd = socketAddress_connect(address);
+        if (fd >= 0)
+            return fd;
+
+        if ((errno != ENOENT && errno != ECONNREFUSED) || uclock() - start > CONNECT_TIMEOUT_US)
+            break;
+
+        poll(NULL, 0, CONNECT_RETRY_MS);
+    }
+
+    LOG_ERROR("Could not connect to the worker %s: %s", address, strerror(errno));
+    return -1;
+}
+
+// sends tiles until the worker has TILES_IN_FLIGHT of them or none are left
+static void fillWorker(Worker* worker)
+{
+    while (worker->fd >= 0 && worker->pendingCount < TILES_IN_FLIGHT && (retryCount > 0 || nextTile < tileCount))
+    {
+        u32 tileIdx = retryCount > 0 ? retryTiles[--retryCount] : nextTile++;
+        if (!sendTile(worker, tileIdx))
+        {
+            retryTiles[retryCount++] = tileIdx;
+            dropWorker(worker);
+        }
+    }
+}
+
+// closes the connection and hands the worker's unfinished tiles to the others
+static void dropWorker(Worker* worker)
+{
+    LOG_WARNING("Leaving out the worker %s, %u of its tiles are traced again", worker->address, worker->pendingCount);
+
+    for (u32 i = 0; i < worker->pendingCount; i++)
+        retryTiles[retryCount++] = worker->pending[i];
+    worker->pendingCount = 0;
+
+    close(worker->fd);
+    worker->fd = -1;
+    liveCount--;
+}
+
+// tiles are numbered row by row from the top left
+static Tile getTile(u32 tileIdx)
+{
+    uvec2 topLeft = {tileIdx % tilesX * TILE_SIZE, tileIdx / tilesX * TILE_SIZE};
+    return (Tile) {topLeft, {min(imageSize.x - topLeft.x, (u32) TILE_SIZE), min(imageSize.y - topLeft.y, (u32) TILE_SIZE)}};
+}
+
+static bool sendTile(Worker* worker, u32 tileIdx)
+{
+    Tile tile = getTile(tileIdx);
+
+    char line[MAX_REPLY_LINE];
+    int length = snprintf(line, sizeof(line), "RENDER %u %u %.9g %.9g %.9g %.9g %.9g %.9g raw crop %u %u %u %u\n",
+                          tile.size.x, tile.size.y, imageCamPos.x, imageCamPos.y, imageCamPos.z,
+                          imageForward.x, imageForward.y, imageForward.z, imageSize.x, imageSize.y, tile.topLeft.x, tile.topLeft.y);
+
+    if (send(worker->fd, line, length, MSG_NOSIGNAL) != length)
+    {
+        LOG_ERROR("Could not send a tile to the worker %s", worker->address);
+        return false;
+    }
+
+    worker->pending[worker->pendingCount++] = tileIdx;
+    return true;
+}
+
+static bool receiveTile(Worker* worker, PpmWriter* writer)
+{
+    char line[MAX_REPLY_LINE];
+    if (!readLine(worker->fd, line, sizeof(line)))
+    {
+        LOG_ERROR("The worker %s disconnected", worker->address);
+        return false;
+    }
+
+    // the tile stays pending until it is written, so a broken answer is traced again
+    Tile tile = getTile(worker->pending[0]);
+
+    u32 width = 0;
+    u32 height = 0;
+    unsigned long long byteCount = 0;
+    if (sscanf(line, "OK %u %u raw %llu", &width, &height, &byteCount) != 3 || width != tile.size.x || height != tile.size.y
+        || byteCount != (u64) width * height * 4)
+    {
+        LOG_ERROR("The worker %s answered a tile with: %s", worker->address, line);
+        return false;
+    }
+
+    u8* rgba = malloc(byteCount);
+    if (rgba == NULL)
+        PANIC("Could not allocate a %ux%u tile", width, height);
+
+    bool success = readAll(worker->fd, rgba, byteCount);
+    if (success)
+    {
+        ppmWriter_writeRect(writer, tile.topLeft, tile.size, rgba, false);
+        worker->tilesDone++;
+        worker->pendingCount--;
+        memmove(worker->pending, worker->pending + 1, worker->pendingCount * sizeof(u32));
+    }
+    else
+    {
+        LOG_ERROR("The worker %s disconnected", worker->address);
+    }
+
+    free(rgba);
+    return success;
+}
+
+// the line is stored without the line break
+static bool readLine(int fd, char* line, u32 maxLength)
+{
+    u32 length = 0;
+    while (length < maxLength - 1)
+    {
+        char c;
+        ssize_t count = recv(fd, &c, 1, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+
+        if (c == '\n')
+            break;
+        line[length++] = c;
+    }
+
+    line[length] = '\0';
+    return true;
+}
+
+static bool readAll(int fd, void* data, u64 size)
+{
+    u8* bytes = data;
+    while (size > 0)
+    {
+        ssize_t count = recv(fd, bytes, size, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+
+        bytes += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include "tiled_capture.h"
+#include "ppm_writer.h"
+#include "cplog.h"
+#include "cptime.h"
+
+bool tiledCapture_capture(Terrain* terrain, vec3 camPos, vec3 forward, const RenderSettings* settings, uvec2 size, const char* path)
+{
+    if (size.x == 0 || size.y == 0)
+    {
+        LOG_ERROR("Invalid capture size %ux%u", size.x, size.y);
+        return false;
+    }
+
+    PpmWriter writer;
+    if (!ppmWriter_open(&writer, path, size))
+        return false;
+
+    u8* rgba = malloc(TILED_CAPTURE_TILE_SIZE * TILED_CAPTURE_TILE_SIZE * 4);
+    if (rgba == NULL)
+        PANIC("Could not allocate a capture tile");
+
+    // tiles traced while the terrain is still streaming in would show different parts of it
+    graphics_finishTerrainUpload(terrain, camPos, forward, settings);
+
+    u32 tilesX = (size.x + TILED_CAPTURE_TILE_SIZE - 1) / TILED_CAPTURE_TILE_SIZE;
+    u32 tilesY = (size.y + TILED_CAPTURE_TILE_SIZE - 1) / TILED_CAPTURE_TILE_SIZE;
+    u64 start = uclock();
+
+    bool traced = true;
+    for (u32 tileY = 0; tileY < tilesY && traced; tileY++)
+        for (u32 tileX = 0; tileX < tilesX && traced; tileX++)
+        {
+            uvec2 topLeft = {tileX * TILED_CAPTURE_TILE_SIZE, tileY * TILED_CAPTURE_TILE_SIZE};
+            uvec2 tileSize = {min(size.x - topLeft.x, (u32) TILED_CAPTURE_TILE_SIZE), min(size.y - topLeft.y, (u32) TILED_CAPTURE_TILE_SIZE)};
+
+            // the tracer counts rows from the bottom
+            RenderView view = {camPos, forward, 0, tileSize, size, {topLeft.x, size.y - topLeft.y - tileSize.y}};
+            ViewRegion region;
+            traced = graphics_drawViews(terrain, &view, 1, settings, &region);
+            if (!traced)
+                break;
+
+            graphics_readView(&region, rgba);
+            ppmWriter_writeRect(&writer, topLeft, tileSize, rgba, true);
+        }
+
+    free(rgba);
+
+    bool written = ppmWriter_close(&writer);
+    if (!traced || !written)
+    {
+        LOG_ERROR("Could not capture %s", path);
+        return false;
+    }
+
+    LOG_INFO("Captured %ux%u pixels in %u tiles into %s (%.02fs)", size.x, size.y, tilesX * tilesY, path, (uclock() - start) / 1000000.0f);
+    return true;
+}
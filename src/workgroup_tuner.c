@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "workgroup_tuner.h"
+#include "cplog.h"
+#include "glad/glad.h"
+
+#define TUNER_CACHE_DIR "shadercache"
+#define TUNER_CACHE_FILE TUNER_CACHE_DIR "/workgroups.txt"
+
+#define MAX_TUNED_ENTRIES 64
+#define MAX_TUNER_KEY 96
+
+// timed runs per candidate (after one warm up run), the fastest one counts
+#define TUNER_RUNS 5
+
+typedef struct TunedEntry
+{
+    char key[MAX_TUNER_KEY];
+    uvec2 workGroupSize;
+} TunedEntry;
+
+const uvec2 WORKGROUP_CANDIDATES[WORKGROUP_CANDIDATE_COUNT] = {{8, 8}, {16, 8}, {32, 4}, {64, 1}};
+
+static TunedEntry* findEntry(const char* key);
+static void storeEntry(const char* key, uvec2 workGroupSize);
+
+// ##### STATE ####
+
+static TunedEntry entries[MAX_TUNED_ENTRIES];
+static u32 entryCount = 0;
+
+static const char* renderer = "";
+
+static u32 query;
+
+// ################
+
+void workGroupTuner_init(void)
+{
+    renderer = (const char*) glGetString(GL_RENDERER);
+    glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+    FILE* file = fopen(TUNER_CACHE_FILE, "r");
+    if (file == NULL)
+        return;
+
+    // one result per line: "<x> <y>\t<key>\t<renderer>", later lines override earlier ones
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        uvec2 size;
+        char key[MAX_TUNER_KEY];
+        int rendererStart = 0;
+        if (sscanf(line, "%u %u\t%95[^\t]\t%n", &size.x, &size.y, key, &rendererStart) != 3 || rendererStart == 0 || size.x * size.y == 0 || size.x * size.y > 1024)
+            continue;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strcmp(line + rendererStart, renderer) == 0)
+            storeEntry(key, size);
+    }
+    fclose(file);
+
+    LOG_INFO("Loaded %u tuned workgroup sizes for %s", entryCount, renderer);
+}
+
+void workGroupTuner_destroy(void)
+{
+    glDeleteQueries(1, &query);
+    entryCount = 0;
+}
+
+uvec2 workGroupTuner_get(const char* key, WorkGroupBenchFunc bench, void* userData)
+{
+    TunedEntry* entry = findEntry(key);
+    if (entry != NULL)
+        return entry->workGroupSize;
+
+    uvec2 best = WORKGROUP_CANDIDATES[0];
+    u64 bestNs = 0xFFFFFFFFFFFFFFFFull;
+    for (u32 i = 0; i < WORKGROUP_CANDIDATE_COUNT; i++)
+    {
+        // the warm up run also absorbs compiling the variant for this size
+        bench(WORKGROUP_CANDIDATES[i], userData);
+
+        u64 candidateNs = 0xFFFFFFFFFFFFFFFFull;
+        for (u32 run = 0; run < TUNER_RUNS; run++)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            bench(WORKGROUP_CANDIDATES[i], userData);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            candidateNs = ns < candidateNs ? ns : candidateNs;
+        }
+
+        LOG_INFO("Tuning %s: %ux%u took %.03fms", key, WORKGROUP_CANDIDATES[i].x, WORKGROUP_CANDIDATES[i].y, candidateNs / 1000000.0f);
+        if (candidateNs < bestNs)
+        {
+            bestNs = candidateNs;
+            best = WORKGROUP_CANDIDATES[i];
+        }
+    }
+
+    storeEntry(key, best);
+
+#ifdef _WIN32
+    _mkdir(TUNER_CACHE_DIR);
+#else
+    mkdir(TUNER_CACHE_DIR, 0755);
+#endif
+
+    // results are only ever appended, entries of other renderers stay untouched
+    FILE* file = fopen(TUNER_CACHE_FILE, "a");
+    if (file != NULL)
+    {
+        fprintf(file, "%u %u\t%s\t%s\n", best.x, best.y, key, renderer);
+        fclose(file);
+    }
+    else
+    {
+        LOG_WARNING("Could not write the workgroup cache file %s", TUNER_CACHE_FILE);
+    }
+
+    return best;
+}
+
+static TunedEntry* findEntry(const char* key)
+{
+    for (u32 i = 0; i < entryCount; i++)
+        if (strcmp(entries[i].key, key) == 0)
+            return &entries[i];
+
+    return NULL;
+}
+
+static void storeEntry(const char* key, uvec2 workGroupSize)
+{
+    TunedEntry* entry = findEntry(key);
+    if (entry == NULL)
+    {
+        if (entryCount == MAX_TUNED_ENTRIES)
+            return;
+        entry = &entries[entryCount++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+    entry->workGroupSize = workGroupSize;
+}